@@ -0,0 +1,91 @@
+//  allocations.cpp: heap allocations of Armadillo per evaluation of -2l, of
+//                   its gradient and per update of beta
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+// Run from the top of the source tree with
+//   Rscript inst/benchmarks/allocations.R
+
+// [[Rcpp::depends(RcppArmadillo)]]
+// [[Rcpp::plugins(cpp11)]]
+
+#include <cstddef>
+#include <cstdlib>
+
+// Every matrix and vector too large for the storage inside the object is
+// allocated through these, so their calls are the heap allocations of
+// Armadillo (those of std containers and of R are not counted)
+namespace alloc_count {
+double n_alloc = 0;
+inline void* Alloc(std::size_t n_bytes) {
+  ++n_alloc;
+  return std::malloc(n_bytes);
+}
+inline void Free(void* ptr) { std::free(ptr); }
+}  // namespace alloc_count
+
+#define ARMA_ALIEN_MEM_ALLOC_FUNCTION alloc_count::Alloc
+#define ARMA_ALIEN_MEM_FREE_FUNCTION alloc_count::Free
+
+#include "../../src/arma_util.cpp"
+#include "../../src/acd.h"
+#include "../../src/hpc.h"
+#include "../../src/mcd.h"
+
+template <typename JMCM>
+Rcpp::NumericVector CountAllocations(const arma::vec& m, const arma::vec& Y,
+                                     const arma::mat& X, const arma::mat& Z,
+                                     const arma::mat& W, const arma::vec& x,
+                                     int n_evals) {
+  JMCM jmcm(m, Y, X, Z, W);
+
+  // Alternate between two points, so that nothing cached for the last one
+  // is reused, after a few evaluations to set up any buffers
+  arma::vec x1 = x * 1.001;
+  arma::vec grad;
+  for (int k = 0; k != 4; ++k) {
+    jmcm(k % 2 ? x1 : x);
+    jmcm.Gradient(k % 2 ? x1 : x, grad);
+  }
+
+  double n0 = alloc_count::n_alloc;
+  for (int k = 0; k != n_evals; ++k) jmcm(k % 2 ? x1 : x);
+  double n1 = alloc_count::n_alloc;
+  for (int k = 0; k != n_evals; ++k) jmcm.Gradient(k % 2 ? x1 : x, grad);
+  double n2 = alloc_count::n_alloc;
+  jmcm.UpdateBeta();
+  double n3 = alloc_count::n_alloc;
+  for (int k = 0; k != n_evals; ++k) jmcm.UpdateBeta();
+  double n4 = alloc_count::n_alloc;
+
+  return Rcpp::NumericVector::create(
+      Rcpp::Named("value") = (n1 - n0) / n_evals,
+      Rcpp::Named("gradient") = (n2 - n1) / n_evals,
+      Rcpp::Named("beta") = (n4 - n3) / n_evals);
+}
+
+// [[Rcpp::export]]
+Rcpp::NumericVector count_allocations(std::string method, arma::vec m,
+                                      arma::vec Y, arma::mat X, arma::mat Z,
+                                      arma::mat W, arma::vec x,
+                                      int n_evals = 100) {
+  if (method == "mcd")
+    return CountAllocations<jmcm::MCD>(m, Y, X, Z, W, x, n_evals);
+  if (method == "acd")
+    return CountAllocations<jmcm::ACD>(m, Y, X, Z, W, x, n_evals);
+  return CountAllocations<jmcm::HPC>(m, Y, X, Z, W, x, n_evals);
+}
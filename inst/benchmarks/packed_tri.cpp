@@ -0,0 +1,156 @@
+//  packed_tri.cpp: microbenchmarks of the packed triangular kernels against
+//                  the index-matrix versions they replace
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+// Run from the top of the source tree with
+//   Rscript inst/benchmarks/packed_tri.R
+
+// [[Rcpp::depends(RcppArmadillo)]]
+// [[Rcpp::plugins(cpp11)]]
+
+#include <chrono>
+
+#include "../../src/arma_util.cpp"
+#include "../../src/packed_tri.h"
+
+namespace legacy {
+
+// pan::ltrimat / pan::lvectorise (byrow = true) as they were, going
+// through n x n index matrices, find and elem
+arma::mat VecToUpperTrimatCol(int n, const arma::vec& x, bool diag) {
+  arma::mat X = arma::eye<arma::mat>(n, n);
+  arma::mat RowIdx(n, n, arma::fill::zeros);
+  arma::mat ColIdx(n, n, arma::fill::zeros);
+  arma::vec idx = arma::linspace<arma::vec>(1, n, n);
+  RowIdx.each_col() += idx;
+  ColIdx.each_row() += trans(idx);
+  if (diag)
+    X.elem(arma::find(RowIdx <= ColIdx)) = x;
+  else
+    X.elem(arma::find(RowIdx < ColIdx)) = x;
+  return X;
+}
+
+arma::vec UpperTrimatToVecCol(const arma::mat& X, bool diag) {
+  int n = X.n_rows;
+  arma::vec x;
+  arma::mat RowIdx(n, n, arma::fill::zeros);
+  arma::mat ColIdx(n, n, arma::fill::zeros);
+  arma::vec idx = arma::linspace<arma::vec>(1, n, n);
+  RowIdx.each_col() += idx;
+  ColIdx.each_row() += trans(idx);
+  if (diag)
+    x = X.elem(arma::find(RowIdx <= ColIdx));
+  else
+    x = X.elem(arma::find(RowIdx < ColIdx));
+  return x;
+}
+
+arma::mat ltrimat(int n, const arma::vec& x, bool diag) {
+  return arma::trans(VecToUpperTrimatCol(n, x, diag));
+}
+
+arma::vec lvectorise(const arma::mat& X, bool diag) {
+  return UpperTrimatToVecCol(X.t(), diag);
+}
+
+}  // namespace legacy
+
+namespace {
+
+template <typename F>
+double NsPerCall(F f, int reps) {
+  auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < reps; ++r) f();
+  auto stop = std::chrono::steady_clock::now();
+  return std::chrono::duration<double, std::nano>(stop - start).count() / reps;
+}
+
+}  // namespace
+
+// Time per call (ns) of unpacking, packing, T x and the inverse of T for a
+// unit lower triangular n x n matrix, with the index-matrix functions, the
+// direct-loop pan:: functions and the packed kernels.
+// [[Rcpp::export]]
+Rcpp::DataFrame bench_packed_tri(int n, int reps = 10000) {
+  arma::uword n_pairs = n * (n - 1) / 2;
+  arma::vec x = 0.1 * arma::randn<arma::vec>(n_pairs);
+  arma::vec r = arma::randn<arma::vec>(n);
+  arma::vec y(n);
+  arma::vec t_inv(n * (n + 1) / 2);
+  arma::mat T = pan::ltrimat(n, x, false);
+  volatile double sink = 0;
+
+  pan::PackedLowerTri packed(x.memptr(), n, false);
+
+  std::vector<std::string> op, method;
+  std::vector<double> ns;
+  auto add = [&](const char* o, const char* m, double t) {
+    op.push_back(o);
+    method.push_back(m);
+    ns.push_back(t);
+  };
+
+  add("unpack", "index matrices", NsPerCall([&] {
+        sink += legacy::ltrimat(n, x, false)(n - 1, 0);
+      }, reps));
+  add("unpack", "pan::ltrimat", NsPerCall([&] {
+        sink += pan::ltrimat(n, x, false)(n - 1, 0);
+      }, reps));
+  add("unpack", "PackedLowerTri", NsPerCall([&] {
+        sink += packed.Unpack()(n - 1, 0);
+      }, reps));
+
+  add("pack", "index matrices", NsPerCall([&] {
+        sink += legacy::lvectorise(T, true)(0);
+      }, reps));
+  add("pack", "pan::lvectorise", NsPerCall([&] {
+        sink += pan::lvectorise(T, true)(0);
+      }, reps));
+  add("pack", "PackedLowerTri", NsPerCall([&] {
+        pan::PackedLowerTri::Pack(T, true, t_inv.memptr());
+        sink += t_inv(0);
+      }, reps));
+
+  add("T * r", "ltrimat + dense", NsPerCall([&] {
+        y = legacy::ltrimat(n, x, false) * r;
+        sink += y(0);
+      }, reps));
+  add("T * r", "PackedLowerTri", NsPerCall([&] {
+        packed.Multiply(r.memptr(), y.memptr());
+        sink += y(0);
+      }, reps));
+
+  add("T^-1", "ltrimat + inv + lvectorise", NsPerCall([&] {
+        arma::mat Ti = legacy::ltrimat(n, x, false);
+        arma::mat Ti_inv;
+        if (!arma::inv(Ti_inv, Ti)) Ti_inv = arma::pinv(Ti);
+        sink += legacy::lvectorise(Ti_inv, true)(0);
+      }, reps));
+  add("T^-1", "PackedLowerTri", NsPerCall([&] {
+        packed.Invert(t_inv.memptr());
+        sink += t_inv(0);
+      }, reps));
+
+  std::vector<int> size(ns.size(), n);
+  return Rcpp::DataFrame::create(Rcpp::Named("n") = size,
+                                 Rcpp::Named("op") = op,
+                                 Rcpp::Named("method") = method,
+                                 Rcpp::Named("ns") = ns,
+                                 Rcpp::Named("stringsAsFactors") = false);
+}
@@ -7,8 +7,8 @@
 using namespace Rcpp;
 
 // mcd_estimation
-Rcpp::List mcd_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z, arma::mat W, arma::vec start, arma::vec mean, bool trace, bool profile, bool errormsg, bool covonly, std::string optim_method);
-RcppExport SEXP _jmcm_mcd_estimation(SEXP mSEXP, SEXP YSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP WSEXP, SEXP startSEXP, SEXP meanSEXP, SEXP traceSEXP, SEXP profileSEXP, SEXP errormsgSEXP, SEXP covonlySEXP, SEXP optim_methodSEXP) {
+Rcpp::List mcd_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z, arma::mat W, arma::vec start, arma::vec mean, bool trace, bool profile, bool errormsg, bool covonly, std::string optim_method, int n_threads, int lbfgs_history, std::string line_search, std::string checkpoint, int checkpoint_every, std::string resume, bool warm_start, std::string trust_hessian);
+RcppExport SEXP _jmcm_mcd_estimation(SEXP mSEXP, SEXP YSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP WSEXP, SEXP startSEXP, SEXP meanSEXP, SEXP traceSEXP, SEXP profileSEXP, SEXP errormsgSEXP, SEXP covonlySEXP, SEXP optim_methodSEXP, SEXP n_threadsSEXP, SEXP lbfgs_historySEXP, SEXP line_searchSEXP, SEXP checkpointSEXP, SEXP checkpoint_everySEXP, SEXP resumeSEXP, SEXP warm_startSEXP, SEXP trust_hessianSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -24,13 +24,21 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< bool >::type errormsg(errormsgSEXP);
     Rcpp::traits::input_parameter< bool >::type covonly(covonlySEXP);
     Rcpp::traits::input_parameter< std::string >::type optim_method(optim_methodSEXP);
-    rcpp_result_gen = Rcpp::wrap(mcd_estimation(m, Y, X, Z, W, start, mean, trace, profile, errormsg, covonly, optim_method));
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< int >::type lbfgs_history(lbfgs_historySEXP);
+    Rcpp::traits::input_parameter< std::string >::type line_search(line_searchSEXP);
+    Rcpp::traits::input_parameter< std::string >::type checkpoint(checkpointSEXP);
+    Rcpp::traits::input_parameter< int >::type checkpoint_every(checkpoint_everySEXP);
+    Rcpp::traits::input_parameter< std::string >::type resume(resumeSEXP);
+    Rcpp::traits::input_parameter< bool >::type warm_start(warm_startSEXP);
+    Rcpp::traits::input_parameter< std::string >::type trust_hessian(trust_hessianSEXP);
+    rcpp_result_gen = Rcpp::wrap(mcd_estimation(m, Y, X, Z, W, start, mean, trace, profile, errormsg, covonly, optim_method, n_threads, lbfgs_history, line_search, checkpoint, checkpoint_every, resume, warm_start, trust_hessian));
     return rcpp_result_gen;
 END_RCPP
 }
 // acd_estimation
-Rcpp::List acd_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z, arma::mat W, arma::vec start, arma::vec mean, bool trace, bool profile, bool errormsg, bool covonly, std::string optim_method);
-RcppExport SEXP _jmcm_acd_estimation(SEXP mSEXP, SEXP YSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP WSEXP, SEXP startSEXP, SEXP meanSEXP, SEXP traceSEXP, SEXP profileSEXP, SEXP errormsgSEXP, SEXP covonlySEXP, SEXP optim_methodSEXP) {
+Rcpp::List acd_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z, arma::mat W, arma::vec start, arma::vec mean, bool trace, bool profile, bool errormsg, bool covonly, std::string optim_method, int n_threads, int lbfgs_history, std::string line_search, std::string checkpoint, int checkpoint_every, std::string resume, bool warm_start, std::string trust_hessian);
+RcppExport SEXP _jmcm_acd_estimation(SEXP mSEXP, SEXP YSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP WSEXP, SEXP startSEXP, SEXP meanSEXP, SEXP traceSEXP, SEXP profileSEXP, SEXP errormsgSEXP, SEXP covonlySEXP, SEXP optim_methodSEXP, SEXP n_threadsSEXP, SEXP lbfgs_historySEXP, SEXP line_searchSEXP, SEXP checkpointSEXP, SEXP checkpoint_everySEXP, SEXP resumeSEXP, SEXP warm_startSEXP, SEXP trust_hessianSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -46,13 +54,21 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< bool >::type errormsg(errormsgSEXP);
     Rcpp::traits::input_parameter< bool >::type covonly(covonlySEXP);
     Rcpp::traits::input_parameter< std::string >::type optim_method(optim_methodSEXP);
-    rcpp_result_gen = Rcpp::wrap(acd_estimation(m, Y, X, Z, W, start, mean, trace, profile, errormsg, covonly, optim_method));
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< int >::type lbfgs_history(lbfgs_historySEXP);
+    Rcpp::traits::input_parameter< std::string >::type line_search(line_searchSEXP);
+    Rcpp::traits::input_parameter< std::string >::type checkpoint(checkpointSEXP);
+    Rcpp::traits::input_parameter< int >::type checkpoint_every(checkpoint_everySEXP);
+    Rcpp::traits::input_parameter< std::string >::type resume(resumeSEXP);
+    Rcpp::traits::input_parameter< bool >::type warm_start(warm_startSEXP);
+    Rcpp::traits::input_parameter< std::string >::type trust_hessian(trust_hessianSEXP);
+    rcpp_result_gen = Rcpp::wrap(acd_estimation(m, Y, X, Z, W, start, mean, trace, profile, errormsg, covonly, optim_method, n_threads, lbfgs_history, line_search, checkpoint, checkpoint_every, resume, warm_start, trust_hessian));
     return rcpp_result_gen;
 END_RCPP
 }
 // hpc_estimation
-Rcpp::List hpc_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z, arma::mat W, arma::vec start, arma::vec mean, bool trace, bool profile, bool errormsg, bool covonly, std::string optim_method);
-RcppExport SEXP _jmcm_hpc_estimation(SEXP mSEXP, SEXP YSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP WSEXP, SEXP startSEXP, SEXP meanSEXP, SEXP traceSEXP, SEXP profileSEXP, SEXP errormsgSEXP, SEXP covonlySEXP, SEXP optim_methodSEXP) {
+Rcpp::List hpc_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z, arma::mat W, arma::vec start, arma::vec mean, bool trace, bool profile, bool errormsg, bool covonly, std::string optim_method, int n_threads, int lbfgs_history, std::string line_search, std::string checkpoint, int checkpoint_every, std::string resume, bool warm_start, std::string trust_hessian);
+RcppExport SEXP _jmcm_hpc_estimation(SEXP mSEXP, SEXP YSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP WSEXP, SEXP startSEXP, SEXP meanSEXP, SEXP traceSEXP, SEXP profileSEXP, SEXP errormsgSEXP, SEXP covonlySEXP, SEXP optim_methodSEXP, SEXP n_threadsSEXP, SEXP lbfgs_historySEXP, SEXP line_searchSEXP, SEXP checkpointSEXP, SEXP checkpoint_everySEXP, SEXP resumeSEXP, SEXP warm_startSEXP, SEXP trust_hessianSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -68,7 +84,75 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< bool >::type errormsg(errormsgSEXP);
     Rcpp::traits::input_parameter< bool >::type covonly(covonlySEXP);
     Rcpp::traits::input_parameter< std::string >::type optim_method(optim_methodSEXP);
-    rcpp_result_gen = Rcpp::wrap(hpc_estimation(m, Y, X, Z, W, start, mean, trace, profile, errormsg, covonly, optim_method));
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< int >::type lbfgs_history(lbfgs_historySEXP);
+    Rcpp::traits::input_parameter< std::string >::type line_search(line_searchSEXP);
+    Rcpp::traits::input_parameter< std::string >::type checkpoint(checkpointSEXP);
+    Rcpp::traits::input_parameter< int >::type checkpoint_every(checkpoint_everySEXP);
+    Rcpp::traits::input_parameter< std::string >::type resume(resumeSEXP);
+    Rcpp::traits::input_parameter< bool >::type warm_start(warm_startSEXP);
+    Rcpp::traits::input_parameter< std::string >::type trust_hessian(trust_hessianSEXP);
+    rcpp_result_gen = Rcpp::wrap(hpc_estimation(m, Y, X, Z, W, start, mean, trace, profile, errormsg, covonly, optim_method, n_threads, lbfgs_history, line_search, checkpoint, checkpoint_every, resume, warm_start, trust_hessian));
+    return rcpp_result_gen;
+END_RCPP
+}
+// start_values
+arma::vec start_values(std::string method, arma::vec m, arma::vec Y, arma::mat X, arma::mat Z, arma::mat W, std::string strategy);
+RcppExport SEXP _jmcm_start_values(SEXP methodSEXP, SEXP mSEXP, SEXP YSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP WSEXP, SEXP strategySEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< arma::vec >::type m(mSEXP);
+    Rcpp::traits::input_parameter< arma::vec >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type X(XSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type Z(ZSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type W(WSEXP);
+    Rcpp::traits::input_parameter< std::string >::type strategy(strategySEXP);
+    rcpp_result_gen = Rcpp::wrap(start_values(method, m, Y, X, Z, W, strategy));
+    return rcpp_result_gen;
+END_RCPP
+}
+// bootstrap_estimation
+Rcpp::List bootstrap_estimation(std::string method, arma::vec m, arma::vec Y, arma::mat X, arma::mat Z, arma::mat W, arma::vec theta, int nboot, int seed, int n_threads, arma::mat X_curve, arma::mat Z_curve, arma::mat W_curve, double level);
+RcppExport SEXP _jmcm_bootstrap_estimation(SEXP methodSEXP, SEXP mSEXP, SEXP YSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP WSEXP, SEXP thetaSEXP, SEXP nbootSEXP, SEXP seedSEXP, SEXP n_threadsSEXP, SEXP X_curveSEXP, SEXP Z_curveSEXP, SEXP W_curveSEXP, SEXP levelSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type method(methodSEXP);
+    Rcpp::traits::input_parameter< arma::vec >::type m(mSEXP);
+    Rcpp::traits::input_parameter< arma::vec >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type X(XSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type Z(ZSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type W(WSEXP);
+    Rcpp::traits::input_parameter< arma::vec >::type theta(thetaSEXP);
+    Rcpp::traits::input_parameter< int >::type nboot(nbootSEXP);
+    Rcpp::traits::input_parameter< int >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type X_curve(X_curveSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type Z_curve(Z_curveSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type W_curve(W_curveSEXP);
+    Rcpp::traits::input_parameter< double >::type level(levelSEXP);
+    rcpp_result_gen = Rcpp::wrap(bootstrap_estimation(method, m, Y, X, Z, W, theta, nboot, seed, n_threads, X_curve, Z_curve, W_curve, level));
+    return rcpp_result_gen;
+END_RCPP
+}
+// search_estimation
+Rcpp::List search_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z, arma::mat W, arma::uvec max_triple, std::vector<std::string> methods, arma::vec start, int n_threads);
+RcppExport SEXP _jmcm_search_estimation(SEXP mSEXP, SEXP YSEXP, SEXP XSEXP, SEXP ZSEXP, SEXP WSEXP, SEXP max_tripleSEXP, SEXP methodsSEXP, SEXP startSEXP, SEXP n_threadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< arma::vec >::type m(mSEXP);
+    Rcpp::traits::input_parameter< arma::vec >::type Y(YSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type X(XSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type Z(ZSEXP);
+    Rcpp::traits::input_parameter< arma::mat >::type W(WSEXP);
+    Rcpp::traits::input_parameter< arma::uvec >::type max_triple(max_tripleSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type methods(methodsSEXP);
+    Rcpp::traits::input_parameter< arma::vec >::type start(startSEXP);
+    Rcpp::traits::input_parameter< int >::type n_threads(n_threadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(search_estimation(m, Y, X, Z, W, max_triple, methods, start, n_threads));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -20,13 +20,17 @@
 #ifndef JMCM_SRC_ACD_H_
 #define JMCM_SRC_ACD_H_
 
+#include <cmath>
+
 #include <algorithm>  // std::equal
+#include <memory>
 
 #define ARMA_DONT_PRINT_ERRORS
 #include <RcppArmadillo.h>
 
 #include "arma_util.h"
 #include "jmcm_base.h"
+#include "packed_tri.h"
 
 namespace jmcm {
 
@@ -38,6 +42,7 @@ class ACD : public JmcmBase {
 
   ACD(const arma::vec& m, const arma::vec& Y, const arma::mat& X,
       const arma::mat& Z, const arma::mat& W);
+  explicit ACD(std::shared_ptr<const JmcmData> data);
 
   // void UpdateBeta();
   void UpdateLambdaGamma(const arma::vec& x) override;
@@ -54,6 +59,8 @@ class ACD : public JmcmBase {
   void get_invT(arma::uword i, arma::mat& Ti_inv) const;
   void get_Sigma_inv(arma::uword i, arma::mat& Sigmai_inv);
 
+  using JmcmBase::operator();
+  using JmcmBase::Gradient;
   double operator()(const arma::vec& x) override;
   void Gradient(const arma::vec& x, arma::vec& grad) override;
   void Grad1(arma::vec& grad1);
@@ -68,25 +75,43 @@ class ACD : public JmcmBase {
   arma::vec TDResid_;
   arma::vec TDResid2_;
 
+  void Whiten(arma::uword i, double* v) const override;
+  void FactorDerivs(arma::uword i, arma::mat& B, arma::cube& dB,
+                    arma::cube* d2B) const override;
+  std::unique_ptr<JmcmBase> NewState() const override {
+    return std::unique_ptr<JmcmBase>(new ACD(data_));
+  }
+
+  // T_i and T_i^{-1} read in place from the packed Wgma_ and invTelem_
+  pan::PackedLowerTri packed_T(arma::uword i) const {
+    return pan::PackedLowerTri(Wgma_.memptr() + index_.pair_begin(i), m_(i),
+                               false);
+  }
+  pan::PackedLowerTri packed_invT(arma::uword i) const {
+    return pan::PackedLowerTri(
+        invTelem_.memptr() + index_.tri_begin(cov_rep(i)), m_(i), true);
+  }
+
   arma::vec get_TDResid(arma::uword i) const;
   arma::vec get_TDResid2(arma::uword i) const;
   void get_TDResid(arma::uword i, arma::vec& TiDiri) const;
   void get_TDResid2(arma::uword i, arma::vec& TiDiri2) const;
+  const arma::vec view_TDResid(arma::uword i) const;
+  const arma::vec view_TDResid2(arma::uword i) const;
 
   void UpdateTelem();
   void UpdateTDResid();
-
-  arma::vec Wijk(arma::uword i, arma::uword j, arma::uword k);
-  arma::vec CalcTijkDeriv(arma::uword i, arma::uword j, arma::uword k);
-  arma::mat CalcTransTiDeriv(arma::uword i);
 };  // class ACD
 
 inline ACD::ACD(const arma::vec& m, const arma::vec& Y, const arma::mat& X,
                 const arma::mat& Z, const arma::mat& W)
-    : JmcmBase(m, Y, X, Z, W, 1) {
+    : ACD(std::make_shared<JmcmData>(m, Y, X, Z, W)) {}
+
+inline ACD::ACD(std::shared_ptr<const JmcmData> data)
+    : JmcmBase(std::move(data), 1) {
   arma::uword N = Y_.n_rows;
 
-  invTelem_ = arma::zeros<arma::vec>(W_.n_rows + N);
+  invTelem_ = arma::zeros<arma::vec>(lags_.n_pairs() + N);
   TDResid_ = arma::zeros<arma::vec>(N);
   TDResid2_ = arma::zeros<arma::vec>(N);
 }
@@ -94,46 +119,18 @@ inline ACD::ACD(const arma::vec& m, const arma::vec& Y, const arma::mat& X,
 inline void ACD::UpdateLambdaGamma(const arma::vec& x) { set_lmdgma(x); }
 
 inline arma::mat ACD::get_D(arma::uword i) const {
-  arma::mat Di = arma::eye(m_(i), m_(i));
-  if (i == 0)
-    Di = arma::diagmat(arma::exp(Zlmd_.subvec(0, m_(0) - 1) / 2));
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    Di = arma::diagmat(arma::exp(Zlmd_.subvec(index, index + m_(i) - 1) / 2));
-  }
-  return Di;
+  arma::uword first_index = index_.obs_begin(i);
+  return arma::diagmat(
+      arma::exp(Zlmd_.subvec(first_index, first_index + m_(i) - 1) / 2));
 }
 
 inline arma::mat ACD::get_T(arma::uword i) const {
-  arma::mat Ti = arma::ones<arma::mat>(m_(i), m_(i));
-  if (m_(i) != 1) {
-    if (i == 0) {
-      arma::uword first_index = 0;
-      arma::uword last_index = m_(0) * (m_(0) - 1) / 2 - 1;
-
-      Ti = pan::ltrimat(m_(0), Wgma_.subvec(first_index, last_index), false);
-    } else {
-      arma::uword first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) - 1) / 2;
-      }
-      arma::uword last_index = first_index + m_(i) * (m_(i) - 1) / 2 - 1;
-
-      Ti = pan::ltrimat(m_(i), Wgma_.subvec(first_index, last_index), false);
-    }
-  }
-  return Ti;
+  return packed_T(i).Unpack();
 }
 
 inline arma::vec ACD::get_mu(arma::uword i) const {
-  arma::vec mui;
-  if (i == 0)
-    mui = Xbta_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    mui = Xbta_.subvec(index, index + m_(i) - 1);
-  }
-  return mui;
+  arma::uword first_index = index_.obs_begin(i);
+  return Xbta_.subvec(first_index, first_index + m_(i) - 1);
 }
 
 inline arma::mat ACD::get_Sigma(arma::uword i) const {
@@ -144,77 +141,32 @@ inline arma::mat ACD::get_Sigma(arma::uword i) const {
 }
 
 inline arma::mat ACD::get_Sigma_inv(arma::uword i) const {
-  arma::mat Ti = get_T(i);
-  //	    arma::mat Ti_inv = arma::pinv(Ti);
-  arma::mat Ti_inv = Ti.i();
+  // T_i^{-1} is kept up to date by UpdateTelem, and with
+  // B = T_i^{-1} D_i^{-1}: Sigma_i^{-1} = B' B
+  arma::mat B;
+  get_invT(i, B);
+  B.each_row() %= arma::exp(-view_Zlmd(i) / 2).t();
 
-  arma::mat Di = get_D(i);
-  arma::mat Di_inv = arma::diagmat(arma::pow(Di.diag(), -1));
-
-  return Di_inv * Ti_inv.t() * Ti_inv * Di_inv;
+  return B.t() * B;
 }
 
 inline arma::vec ACD::get_Resid(arma::uword i) const {
-  arma::vec ri;
-  if (i == 0)
-    ri = Resid_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    ri = Resid_.subvec(index, index + m_(i) - 1);
-  }
-  return ri;
+  arma::uword first_index = index_.obs_begin(i);
+  return Resid_.subvec(first_index, first_index + m_(i) - 1);
 }
 
 inline void ACD::get_D(arma::uword i, arma::mat& Di) const {
-  Di = arma::eye(m_(i), m_(i));
-  if (i == 0)
-    Di = arma::diagmat(arma::exp(Zlmd_.subvec(0, m_(0) - 1) / 2));
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    Di = arma::diagmat(arma::exp(Zlmd_.subvec(index, index + m_(i) - 1) / 2));
-  }
+  arma::uword first_index = index_.obs_begin(i);
+  Di = arma::diagmat(
+      arma::exp(Zlmd_.subvec(first_index, first_index + m_(i) - 1) / 2));
 }
 
 inline void ACD::get_T(arma::uword i, arma::mat& Ti) const {
-  Ti = arma::eye<arma::mat>(m_(i), m_(i));
-  if (m_(i) != 1) {
-    if (i == 0) {
-      arma::uword first_index = 0;
-      arma::uword last_index = m_(0) * (m_(0) - 1) / 2 - 1;
-
-      Ti = pan::ltrimat(m_(0), Wgma_.subvec(first_index, last_index), false);
-    } else {
-      arma::uword first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) - 1) / 2;
-      }
-      arma::uword last_index = first_index + m_(i) * (m_(i) - 1) / 2 - 1;
-
-      Ti = pan::ltrimat(m_(i), Wgma_.subvec(first_index, last_index), false);
-    }
-  }
+  packed_T(i).Unpack(Ti);
 }
 
 inline void ACD::get_invT(arma::uword i, arma::mat& Ti_inv) const {
-  Ti_inv = arma::eye(m_(i), m_(i));
-  if (m_(i) != 1) {
-    if (i == 0) {
-      arma::uword first_index = 0;
-      arma::uword last_index = m_(0) * (m_(0) + 1) / 2 - 1;
-
-      Ti_inv =
-          pan::ltrimat(m_(0), invTelem_.subvec(first_index, last_index), true);
-    } else {
-      arma::uword first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) + 1) / 2;
-      }
-      arma::uword last_index = first_index + m_(i) * (m_(i) + 1) / 2 - 1;
-
-      Ti_inv =
-          pan::ltrimat(m_(i), invTelem_.subvec(first_index, last_index), true);
-    }
-  }
+  packed_invT(i).Unpack(Ti_inv);
 }
 
 inline void ACD::get_Sigma_inv(arma::uword i, arma::mat& Sigmai_inv) {
@@ -232,27 +184,37 @@ inline void ACD::get_Sigma_inv(arma::uword i, arma::mat& Sigmai_inv) {
 }
 
 inline double ACD::operator()(const arma::vec& x) {
+  ++eval_counts_.n_value;
   UpdateJmcm(x);
 
-  arma::uword i, n_sub = m_.n_elem;
-  double result = 0.0;
-
-  for (i = 0; i < n_sub; ++i) {
-    arma::vec ri = get_Resid(i);
-    arma::mat Sigmai_inv;
-    get_Sigma_inv(i, Sigmai_inv);
-    result += arma::as_scalar(ri.t() * Sigmai_inv * ri);
+  if (scatter_path()) {
+    // sum_i e_i' e_i = tr(B R R' B'), B = T^{-1} D^{-1}
+    double n_sub = m_.n_elem;
+    return arma::trace(WhitenedScatter()) +
+           n_sub * arma::accu(view_Zlmd(0));
   }
 
-  result += 2 * arma::sum(arma::log(arma::exp(Zlmd_ / 2)));
-
-  return result;
+  // with e_i = T_i^{-1} D_i^{-1} r_i kept in TDResid_:
+  // r_i' Sigma_i^{-1} r_i = e_i' e_i, and log|Sigma_i| = sum_j log D_ijj^2
+  // as |T_i| = 1
+  const double* zlmd = Zlmd_.memptr();
+  const double* e = TDResid_.memptr();
+  const double* w = obs_weight_.memptr();
+  const pan::ChunkPlan& chunks = subject_plan_;
+  return pan::ParallelSum(
+      chunks, team(), 0.0, [&](arma::uword c, double& part) {
+        arma::uword first = index_.obs_begin(chunks.begin(c)),
+                    last = index_.obs_begin(chunks.end(c));
+        for (arma::uword k = first; k != last; ++k)
+          part += w[k] * (e[k] * e[k] + zlmd[k]);
+      });
 }
 
 inline void ACD::Gradient(const arma::vec& x, arma::vec& grad) {
+  ++eval_counts_.n_gradient;
   UpdateJmcm(x);
 
-  arma::uword n_bta = X_.n_cols, n_lmd = Z_.n_cols, n_gma = W_.n_cols;
+  arma::uword n_bta = X_.n_cols, n_lmd = Z_.n_cols, n_gma = lags_.n_cols();
 
   arma::vec grad1, grad2, grad3;
 
@@ -282,49 +244,119 @@ inline void ACD::Gradient(const arma::vec& x, arma::vec& grad) {
 }
 
 inline void ACD::Grad1(arma::vec& grad1) {
-  arma::uword n_sub = m_.n_elem, n_bta = X_.n_cols;
-  grad1 = arma::zeros<arma::vec>(n_bta);
-
-  for (arma::uword i = 0; i < n_sub; ++i) {
-    arma::mat Xi = get_X(i);
-    arma::vec ri = get_Resid(i);
-    arma::mat Sigmai_inv;
-    get_Sigma_inv(i, Sigmai_inv);
-    grad1 += Xi.t() * Sigmai_inv * ri;
+  arma::uword n_sub = m_.n_elem;
+
+  // Sigma_i^{-1} r_i = D_i^{-1} T_i^{-T} e_i stacked over subjects, so that
+  // the sum of the X_i' Sigma_i^{-1} r_i is a single product with X
+  arma::vec SigmaResid(Resid_.n_rows);
+  if (balanced_) {
+    arma::mat T_inv;
+    get_invT(0, T_inv);
+
+    arma::mat SR(SigmaResid.memptr(), m_(0), n_sub, false, true);
+    SR = T_inv.t() * MatView(TDResid_, m_(0), n_sub);
+  } else {
+    const pan::ChunkPlan& chunks = subject_plan_;
+    pan::ParallelFor(chunks, team(), [&](arma::uword c) {
+      for (arma::uword i = chunks.begin(c); i != chunks.end(c); ++i) {
+        arma::uword first_index = index_.obs_begin(i);
+        packed_invT(i).MultiplyTrans(TDResid_.memptr() + first_index,
+                                     SigmaResid.memptr() + first_index);
+      }
+    });
   }
+  patterns_.RecordSweep();
+  SigmaResid %= arma::exp(-Zlmd_ / 2);
+  if (weighted_) SigmaResid %= obs_weight_;
 
-  grad1 *= -2;
+  grad1 = -2 * (X_.t() * SigmaResid);
 }
 
-inline void ACD::Grad2(arma::vec& grad2) {
-  arma::uword i, n_sub = m_.n_elem, n_lmd = Z_.n_cols, n_gma = W_.n_cols;
-  grad2 = arma::zeros<arma::vec>(n_lmd + n_gma);
-  arma::vec grad2_lmd = arma::zeros<arma::vec>(n_lmd);
-  arma::vec grad2_gma = arma::zeros<arma::vec>(n_gma);
-
-  for (i = 0; i < n_sub; ++i) {
-    arma::vec one = arma::ones<arma::vec>(m_(i));
-    arma::mat Zi = get_Z(i);
-    arma::vec hi;
-    get_TDResid2(i, hi);
+inline void ACD::Whiten(arma::uword i, double* v) const {
+  const double* zlmd = Zlmd_.memptr() + index_.obs_begin(i);
 
-    grad2_lmd += 0.5 * Zi.t() * (hi - one);
+  for (arma::uword j = 0; j != m_(i); ++j) v[j] *= std::exp(-zlmd[j] / 2);
+  packed_invT(i).Multiply(v, v);
+}
 
-    arma::mat Ti;
-    get_T(i, Ti);
-    //	    arma::mat Ti_inv = arma::pinv(Ti);
-    // arma::mat Ti_inv = Ti.i();
-    arma::mat Ti_inv;
-    get_invT(i, Ti_inv);
+inline void ACD::FactorDerivs(arma::uword i, arma::mat& B, arma::cube& dB,
+                              arma::cube* d2B) const {
+  // B = T^{-1} D^{-1/2} with T linear in gamma, dT / dgamma_c = G_c
+  arma::mat Ti_inv;
+  get_invT(i, Ti_inv);
+  B = Ti_inv.each_row() % arma::exp(-view_Zlmd(i) / 2).t();
 
-    arma::vec ei;
-    get_TDResid(i, ei);
+  InvFactorDerivs(i, Ti_inv, B, PairSlices(i), arma::cube(), dB, d2B);
+}
 
-    arma::mat Ti_trans_deriv = CalcTransTiDeriv(i);
+inline void ACD::Grad2(arma::vec& grad2) {
+  arma::uword n_sub = m_.n_elem, n_lmd = Z_.n_cols, n_gma = lags_.n_cols();
+  grad2 = arma::zeros<arma::vec>(n_lmd + n_gma);
 
-    grad2_gma += arma::kron(ei.t(), arma::eye(n_gma, n_gma)) * Ti_trans_deriv *
-                 Ti_inv.t() * ei;
-  }
+  // sum_i 0.5 * Z_i' (h_i - 1), all subjects at once
+  arma::vec u = TDResid2_ - 1.0;
+  if (weighted_) u %= obs_weight_;
+  arma::vec grad2_lmd = 0.5 * (Z_.t() * u);
+
+  // As dT_i / dgamma = W_ijk at (j, k), j > k, the gamma part is
+  //   sum_i w_i sum_{j > k} W_ijk (T_i^{-T} e_i)_j e_ik
+  //     = sum_{j > k} W_ijk M_jk,   M = T_i^{-T} sum_i w_i e_i e_i'
+  // within a covariance pattern. The scalars M_jk are summed per distinct
+  // lag before the product with W, over chunks of patterns. A pattern with
+  // at most m_i subjects adds f_i e_i', f_i = T_i^{-T} e_i, subject by
+  // subject in O(m_i^2); a larger one forms sum_i w_i e_i e_i' first.
+  const pan::ChunkPlan& chunks = pattern_plan_;
+  arma::vec zero = arma::zeros<arma::vec>(lags_.n_lag());
+  arma::vec c = pan::ParallelSum(
+      chunks, team(), zero, [&](arma::uword ch, arma::vec& part) {
+        arma::vec f;
+        for (arma::uword p = chunks.begin(ch); p != chunks.end(ch); ++p) {
+          arma::uword rep = patterns_.rep_of(p), mi = m_(rep),
+                      first_pair = index_.pair_begin(rep);
+          const pan::PackedLowerTri Ti_inv = packed_invT(rep);
+
+          if (patterns_.size(p) <= mi) {
+            f.set_size(mi);
+            for (arma::uword s = patterns_.begin(p); s != patterns_.end(p);
+                 ++s) {
+              arma::uword i = patterns_.subject(s);
+              const double* ei = TDResid_.memptr() + index_.obs_begin(i);
+              Ti_inv.MultiplyTrans(ei, f.memptr());
+              if (weighted_) f *= weight_(i);
+
+              for (arma::uword j = 1; j < mi; ++j)
+                for (arma::uword k = 0; k < j; ++k)
+                  part(lags_.lag_id(first_pair + j * (j - 1) / 2 + k)) +=
+                      f(j) * ei[k];
+            }
+            continue;
+          }
+
+          arma::mat M;
+          if (scatter_path()) {
+            M = WhitenedScatter();  // E E' = B R R' B'
+          } else if (balanced_) {
+            const arma::mat E = MatView(TDResid_, mi, n_sub);
+            M = E * (E.each_row() % weight_.t()).t();
+          } else {
+            M = arma::zeros<arma::mat>(mi, mi);
+            for (arma::uword s = patterns_.begin(p); s != patterns_.end(p);
+                 ++s) {
+              arma::uword i = patterns_.subject(s);
+              const arma::vec ei = view_TDResid(i);
+              M += weight_(i) * (ei * ei.t());
+            }
+          }
+          for (arma::uword k = 0; k != mi; ++k)
+            Ti_inv.MultiplyTrans(M.colptr(k), M.colptr(k));
+
+          for (arma::uword j = 1; j < mi; ++j)
+            for (arma::uword k = 0; k < j; ++k)
+              part(lags_.lag_id(first_pair + j * (j - 1) / 2 + k)) += M(j, k);
+        }
+      });
+  arma::vec grad2_gma = lags_.MultiplyTrans(c);
+  patterns_.RecordSweep();
   grad2.subvec(0, n_lmd - 1) = grad2_lmd;
   grad2.subvec(n_lmd, n_lmd + n_gma - 1) = grad2_gma;
 
@@ -353,6 +385,7 @@ inline void ACD::UpdateJmcm(const arma::vec& x) {
   }
 
   if (update) {
+    ++eval_counts_.n_update;
     UpdateParam(x);
     UpdateModel();
   } else {
@@ -363,7 +396,7 @@ inline void ACD::UpdateJmcm(const arma::vec& x) {
 inline void ACD::UpdateParam(const arma::vec& x) {
   arma::uword n_bta = X_.n_cols;
   arma::uword n_lmd = Z_.n_cols;
-  arma::uword n_gma = W_.n_cols;
+  arma::uword n_gma = lags_.n_cols();
 
   switch (free_param_) {
     case 0:
@@ -400,8 +433,8 @@ inline void ACD::UpdateModel() {
         Xbta_ = X_ * beta_;
 
       Zlmd_ = Z_ * lambda_;
-      Wgma_ = W_ * gamma_;
-      Resid_ = Y_ - Xbta_;
+      lags_.Multiply(gamma_, Wgma_);
+      UpdateResid();
 
       UpdateTelem();
       UpdateTDResid();
@@ -413,7 +446,7 @@ inline void ACD::UpdateModel() {
         Xbta_ = mean_;
       else
         Xbta_ = X_ * beta_;
-      Resid_ = Y_ - Xbta_;
+      UpdateResid();
 
       UpdateTDResid();
 
@@ -421,7 +454,7 @@ inline void ACD::UpdateModel() {
 
     case 23:
       Zlmd_ = Z_ * lambda_;
-      Wgma_ = W_ * gamma_;
+      lags_.Multiply(gamma_, Wgma_);
 
       UpdateTelem();
       UpdateTDResid();
@@ -434,146 +467,82 @@ inline void ACD::UpdateModel() {
 }
 
 inline arma::vec ACD::get_TDResid(arma::uword i) const {
-  arma::vec TiDiri;
-  if (i == 0)
-    TiDiri = TDResid_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    TiDiri = TDResid_.subvec(index, index + m_(i) - 1);
-  }
-  return TiDiri;
+  return view_TDResid(i);
 }
 
 inline void ACD::get_TDResid(arma::uword i, arma::vec& TiDiri) const {
-  if (i == 0)
-    TiDiri = TDResid_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    TiDiri = TDResid_.subvec(index, index + m_(i) - 1);
-  }
+  TiDiri = view_TDResid(i);
 }
 
 inline arma::vec ACD::get_TDResid2(arma::uword i) const {
-  arma::vec TiDiri2;
-  if (i == 0)
-    TiDiri2 = TDResid2_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    TiDiri2 = TDResid2_.subvec(index, index + m_(i) - 1);
-  }
-  return TiDiri2;
+  return view_TDResid2(i);
 }
 
-inline void ACD::get_TDResid2(arma::uword i, arma::vec& TiDiri2) const {
-  if (i == 0)
-    TiDiri2 = TDResid2_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    TiDiri2 = TDResid2_.subvec(index, index + m_(i) - 1);
-  }
+inline void ACD::get_TDResid2(arma::uword i,
+                                 arma::vec& TiDiri2) const {
+  TiDiri2 = view_TDResid2(i);
 }
 
-inline void ACD::UpdateTelem() {
-  arma::uword i, n_sub = m_.n_elem;
-
-  for (i = 0; i < n_sub; ++i) {
-    arma::mat Ti;
-    get_T(i, Ti);
-    // arma::mat Ti_inv = arma::pinv(Ti);
-    // arma::mat Ti_inv = Ti.i();
-    // arma::mat Ti_inv = pinv(Ti);
-    arma::mat Ti_inv;
-    // bool is_Ti_pd = arma::inv(Ti_inv, Ti);
-    // if (!is_Ti_pd) Ti_inv = arma::pinv(Ti);
-    if (!arma::inv(Ti_inv, Ti)) Ti_inv = arma::pinv(Ti);
-
-    if (i == 0) {
-      arma::uword first_index = 0;
-      arma::uword last_index = m_(0) * (m_(0) + 1) / 2 - 1;
-
-      invTelem_.subvec(first_index, last_index) = pan::lvectorise(Ti_inv, true);
-    } else {
-      arma::uword first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) + 1) / 2;
-      }
-      arma::uword last_index = first_index + m_(i) * (m_(i) + 1) / 2 - 1;
-
-      invTelem_.subvec(first_index, last_index) = pan::lvectorise(Ti_inv, true);
-    }
-  }
+inline const arma::vec ACD::view_TDResid(arma::uword i) const {
+  return ColView(TDResid_, index_.obs_begin(i), m_(i));
 }
 
-inline void ACD::UpdateTDResid() {
-  arma::uword i, n_sub = m_.n_elem;
-
-  for (i = 0; i < n_sub; ++i) {
-    arma::vec ri = get_Resid(i);
-
-    arma::mat Ti = get_T(i);
-    //	    arma::mat Ti_inv = arma::pinv(Ti);
-    // arma::mat Ti_inv = Ti.i();
-    arma::mat Ti_inv;
-    get_invT(i, Ti_inv);
-
-    arma::mat Di = get_D(i);
-    arma::mat Di_inv = arma::diagmat(arma::pow(Di.diag(), -1));
-
-    arma::vec TiDiri = Ti_inv * Di_inv * ri;
-    arma::vec TiDiri2 = arma::diagvec(Ti_inv.t() * Ti_inv * Di_inv * ri *
-                                      ri.t() * Di_inv);  // hi
-
-    if (i == 0) {
-      TDResid_.subvec(0, m_(0) - 1) = TiDiri;
-      TDResid2_.subvec(0, m_(0) - 1) = TiDiri2;
-    } else {
-      arma::uword index = arma::sum(m_.subvec(0, i - 1));
-      TDResid_.subvec(index, index + m_(i) - 1) = TiDiri;
-      TDResid2_.subvec(index, index + m_(i) - 1) = TiDiri2;
-    }
-  }
+inline const arma::vec ACD::view_TDResid2(arma::uword i) const {
+  return ColView(TDResid2_, index_.obs_begin(i), m_(i));
 }
 
-inline arma::vec ACD::Wijk(arma::uword i, arma::uword j, arma::uword k) {
-  arma::uword n_sub = m_.n_rows;
-  arma::uword n_gma = W_.n_cols;
-
-  arma::uword W_rowindex = 0;
-  bool indexfound = false;
-  arma::vec result = arma::zeros<arma::vec>(n_gma);
-  for (arma::uword ii = 0; ii != n_sub && !indexfound; ++ii) {
-    for (arma::uword jj = 0; jj != m_(ii) && !indexfound; ++jj) {
-      for (arma::uword kk = 0; kk != jj && !indexfound; ++kk) {
-        if (ii == i && jj == j && kk == k) {
-          indexfound = true;
-          result = W_.row(W_rowindex).t();
+inline void ACD::UpdateTelem() {
+  // only for the representative of each covariance pattern (see cov_rep);
+  // T_i is unit lower triangular, so its inverse is always well defined
+  const pan::ChunkPlan& chunks = pattern_plan_;
+  solver_stats_ += pan::ParallelSum(
+      chunks, team(), pan::SolverStats(),
+      [&](arma::uword c, pan::SolverStats& stats) {
+        for (arma::uword p = chunks.begin(c); p != chunks.end(c); ++p) {
+          arma::uword i = patterns_.rep_of(p);
+          pan::InvertLowerTri(packed_T(i),
+                              invTelem_.memptr() + index_.tri_begin(i), &stats);
         }
-        ++W_rowindex;
-      }
-    }
-  }
-  return result;
-}
-
-inline arma::vec ACD::CalcTijkDeriv(arma::uword i, arma::uword j,
-                                    arma::uword k) {
-  arma::vec result = Wijk(i, j, k);
-
-  return result;
+      });
+  patterns_.RecordSweep();
 }
 
-inline arma::mat ACD::CalcTransTiDeriv(arma::uword i) {
-  arma::uword n_gma = W_.n_cols;
-
-  arma::mat result = arma::zeros<arma::mat>(n_gma * m_(i), m_(i));
-  for (arma::uword k = 1; k != m_(i); ++k) {
-    for (arma::uword j = 0; j <= k; ++j) {
-      result.submat(j * n_gma, k, (j * n_gma + n_gma - 1), k) =
-          CalcTijkDeriv(i, k, j);
-    }
+inline void ACD::UpdateTDResid() {
+  arma::uword n_sub = m_.n_elem;
+
+  if (balanced_) {
+    arma::mat T_inv;
+    get_invT(0, T_inv);
+
+    // with R = [r_1, ..., r_n]: E = T^{-1} D^{-1} R and
+    // H = (T^{-T} E) % (D^{-1} R), whose columns are e_i and h_i
+    arma::mat DR = MatView(Resid_, m_(0), n_sub).each_col() %
+                   arma::exp(-view_Zlmd(0) / 2);
+
+    arma::mat E(TDResid_.memptr(), m_(0), n_sub, false, true);
+    arma::mat H(TDResid2_.memptr(), m_(0), n_sub, false, true);
+    E = T_inv * DR;
+    H = (T_inv.t() * E) % DR;
+    patterns_.RecordSweep();
+    return;
   }
 
-  return result;
+  const pan::ChunkPlan& chunks = subject_plan_;
+  pan::ParallelFor(chunks, team(), [&](arma::uword c) {
+    for (arma::uword i = chunks.begin(c); i != chunks.end(c); ++i) {
+      pan::PackedLowerTri Ti_inv = packed_invT(i);
+      arma::vec Diri = arma::exp(-view_Zlmd(i) / 2) % view_Resid(i);
+
+      // e_i = T_i^{-1} D_i^{-1} r_i and h_i = (T_i^{-T} e_i) % D_i^{-1} r_i,
+      // the latter built in place in TDResid2_
+      double* ei = TDResid_.memptr() + index_.obs_begin(i);
+      double* hi = TDResid2_.memptr() + index_.obs_begin(i);
+      Ti_inv.Multiply(Diri.memptr(), ei);
+      Ti_inv.MultiplyTrans(ei, hi);
+      for (arma::uword j = 0; j != m_(i); ++j) hi[j] *= Diri(j);
+    }
+  });
+  patterns_.RecordSweep();
 }
 
 }  // namespace jmcm
@@ -21,24 +21,17 @@
 
 namespace pan {
 
+// The triangular elements are visited directly in the order of the packed
+// vector, instead of building index matrices and going through find/elem.
+
 arma::mat VecToUpperTrimatCol(int n, const arma::vec& x, bool diag) {
   arma::mat X = arma::eye<arma::mat>(n, n);
 
-  // make empty matrices
-  arma::mat RowIdx(n, n, arma::fill::zeros);
-  arma::mat ColIdx(n, n, arma::fill::zeros);
-
-  // fill matrices with integers
-  arma::vec idx = arma::linspace<arma::vec>(1, n, n);
-  RowIdx.each_col() += idx;
-  ColIdx.each_row() += trans(idx);
-
-  // assign upper triangular elements
-  // the >= allows inclusion of diagonal elements
-  if (diag)
-    X.elem(arma::find(RowIdx <= ColIdx)) = x;
-  else
-    X.elem(arma::find(RowIdx < ColIdx)) = x;
+  const double* px = x.memptr();
+  for (int j = 0; j < n; ++j) {
+    int last = diag ? j : j - 1;
+    for (int i = 0; i <= last; ++i) X(i, j) = *px++;
+  }
 
   return X;
 }
@@ -46,21 +39,11 @@ arma::mat VecToUpperTrimatCol(int n, const arma::vec& x, bool diag) {
 arma::mat VecToLowerTrimatCol(int n, const arma::vec& x, bool diag) {
   arma::mat X = arma::eye<arma::mat>(n, n);
 
-  // make empty matrices
-  arma::mat RowIdx(n, n, arma::fill::zeros);
-  arma::mat ColIdx(n, n, arma::fill::zeros);
-
-  // fill matrices with integers
-  arma::vec idx = arma::linspace<arma::vec>(1, n, n);
-  RowIdx.each_col() += idx;
-  ColIdx.each_row() += trans(idx);
-
-  // assign upper triangular elements
-  // the >= allows inclusion of diagonal elements
-  if (diag)
-    X.elem(arma::find(RowIdx >= ColIdx)) = x;
-  else
-    X.elem(arma::find(RowIdx > ColIdx)) = x;
+  const double* px = x.memptr();
+  for (int j = 0; j < n; ++j) {
+    int first = diag ? j : j + 1;
+    for (int i = first; i < n; ++i) X(i, j) = *px++;
+  }
 
   return X;
 }
@@ -68,56 +51,45 @@ arma::mat VecToLowerTrimatCol(int n, const arma::vec& x, bool diag) {
 arma::mat ltrimat(int n, const arma::vec& x, bool diag, bool byrow) {
   arma::mat X;
 
-  if (byrow)
-    X = arma::trans(VecToUpperTrimatCol(n, x, diag));
-  else
+  if (byrow) {
+    // the transpose of the column-major upper triangle, i.e. the lower
+    // triangle by row
+    X = arma::eye<arma::mat>(n, n);
+
+    const double* px = x.memptr();
+    for (int i = 0; i < n; ++i) {
+      int last = diag ? i : i - 1;
+      for (int j = 0; j <= last; ++j) X(i, j) = *px++;
+    }
+  } else {
     X = VecToLowerTrimatCol(n, x, diag);
+  }
 
   return X;
 }
 
 arma::vec UpperTrimatToVecCol(const arma::mat& X, bool diag) {
   int n = X.n_rows;
-  arma::vec x;
+  arma::vec x(diag ? n * (n + 1) / 2 : n * (n - 1) / 2);
 
-  // make empty matrices
-  arma::mat RowIdx(n, n, arma::fill::zeros);
-  arma::mat ColIdx(n, n, arma::fill::zeros);
-
-  // fill matrices with integers
-  arma::vec idx = arma::linspace<arma::vec>(1, n, n);
-  RowIdx.each_col() += idx;
-  ColIdx.each_row() += trans(idx);
-
-  // assign upper triangular elements
-  // the >= allows inclusion of diagonal elements
-  if (diag)
-    x = X.elem(arma::find(RowIdx <= ColIdx));
-  else
-    x = X.elem(arma::find(RowIdx < ColIdx));
+  double* px = x.memptr();
+  for (int j = 0; j < n; ++j) {
+    int last = diag ? j : j - 1;
+    for (int i = 0; i <= last; ++i) *px++ = X(i, j);
+  }
 
   return x;
 }
 
 arma::vec LowerTrimatToVecCol(const arma::mat& X, bool diag) {
   int n = X.n_rows;
-  arma::vec x;
-
-  // make empty matrices
-  arma::mat RowIdx(n, n, arma::fill::zeros);
-  arma::mat ColIdx(n, n, arma::fill::zeros);
-
-  // fill matrices with integers
-  arma::vec idx = arma::linspace<arma::vec>(1, n, n);
-  RowIdx.each_col() += idx;
-  ColIdx.each_row() += trans(idx);
+  arma::vec x(diag ? n * (n + 1) / 2 : n * (n - 1) / 2);
 
-  // assign upper triangular elements
-  // the >= allows inclusion of diagonal elements
-  if (diag)
-    x = X.elem(arma::find(RowIdx >= ColIdx));
-  else
-    x = X.elem(arma::find(RowIdx > ColIdx));
+  double* px = x.memptr();
+  for (int j = 0; j < n; ++j) {
+    int first = diag ? j : j + 1;
+    for (int i = first; i < n; ++i) *px++ = X(i, j);
+  }
 
   return x;
 }
@@ -125,10 +97,19 @@ arma::vec LowerTrimatToVecCol(const arma::mat& X, bool diag) {
 arma::vec lvectorise(const arma::mat& X, bool diag, bool byrow) {
   arma::vec x;
 
-  if (byrow)
-    x = UpperTrimatToVecCol(X.t(), diag);
-  else
+  if (byrow) {
+    // UpperTrimatToVecCol(X.t()) without forming the transpose
+    int n = X.n_rows;
+    x.set_size(diag ? n * (n + 1) / 2 : n * (n - 1) / 2);
+
+    double* px = x.memptr();
+    for (int i = 0; i < n; ++i) {
+      int last = diag ? i : i - 1;
+      for (int j = 0; j <= last; ++j) *px++ = X(i, j);
+    }
+  } else {
     x = LowerTrimatToVecCol(X, diag);
+  }
 
   return x;
 }
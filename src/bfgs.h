@@ -7,10 +7,13 @@
 
 #include <algorithm>
 #include <cmath>
+#include <functional>
 #include <iomanip>
 #include <limits>
 
+#include "checkpoint.h"
 #include "linesearch.h"
+#include "optim_stats.h"
 #include <RcppArmadillo.h>
 
 namespace pan {
@@ -26,12 +29,46 @@ class BFGS : public LineSearch<T> {
   void Optimize(T& func, arma::vec& x, const double grad_tol = 1e-6);
   int n_iters() const;
   double f_min() const;
+  StopReason stop_reason() const { return stop_reason_; }
+
+  // Calls save with the state (phase 1) at the start of every every'th
+  // iteration, none for every = 0
+  void set_checkpoint(int every, std::function<void(const Checkpoint&)> save) {
+    checkpoint_every_ = every;
+    save_ = save;
+  }
+  // The next Optimize continues from state in place of starting at x
+  void set_resume(const Checkpoint& state) {
+    resume_ = state;
+    resume_pending_ = true;
+  }
+
+  // With warm_start, the inverse Hessian is kept at the end of Optimize and
+  // the next Optimize over as many parameters starts from it, scaled by
+  // s'y / y'Hy at its first update (Shanno and Phua) as the objective may
+  // have changed in between, e.g. the block of a profile likelihood
+  void set_warm_start(bool warm_start) {
+    warm_start_ = warm_start;
+    if (!warm_start) hess_inv_.reset();
+  }
+  // the kept inverse Hessian, empty before the first warm Optimize
+  const arma::mat& curvature() const { return hess_inv_; }
+  void set_curvature(const arma::mat& hess_inv) { hess_inv_ = hess_inv; }
 
  private:
   bool trace_;
   // bool message_;
   int n_iters_;
   double f_min_;
+  StopReason stop_reason_;
+
+  int checkpoint_every_;
+  std::function<void(const Checkpoint&)> save_;
+  Checkpoint resume_;
+  bool resume_pending_;
+
+  bool warm_start_;
+  arma::mat hess_inv_;
 };  // class BFGS
 
 #include "bfgs_impl.h"
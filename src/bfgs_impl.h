@@ -6,7 +6,12 @@
  * Constructor
  */
 template <typename T>
-BFGS<T>::BFGS() : LineSearch<T>() {}
+BFGS<T>::BFGS()
+    : LineSearch<T>(),
+      stop_reason_(StopReason::kNone),
+      checkpoint_every_(0),
+      resume_pending_(false),
+      warm_start_(false) {}
 
 /**
  * Destructor
@@ -39,41 +44,83 @@ void BFGS<T>::Optimize(T &func, arma::vec &x, const double grad_tol) {
 
   const int n_pars = x.n_rows;  // number of parameters
 
-  // Calculate starting function value and gradient
-  if (debug) {
-    Rcpp::Rcout << "Initializing the function value" << std::endl;
-  }
+  // Calculate the maximum step length
+  double sum = sqrt(arma::dot(x, x));
+  const double kStepMax = resume_pending_
+                              ? resume_.stepmax
+                              : kScaStepMax * std::max(sum, double(n_pars));
+
+  double f;
+  arma::vec grad, p;
+  arma::mat hess_inv;
+  int first_iter = 0;
+  bool rescale = false;
+
+  if (resume_pending_) {
+    // Continue from the checkpoint
+    resume_pending_ = false;
+    x = resume_.x;
+    f = resume_.f;
+    grad = resume_.grad;
+    hess_inv = resume_.hess_inv;
+    p = resume_.p;
+    first_iter = resume_.iter;
+  } else {
+    // Calculate starting function value and gradient
+    if (debug) {
+      Rcpp::Rcout << "Initializing the function value" << std::endl;
+    }
 
-  double f = func(x);
+    f = func(x);
 
-  if (debug) {
-    Rcpp::Rcout << "Initializing the gradient" << std::endl;
-  }
-
-  arma::vec grad;
-  func.Gradient(x, grad);
+    if (debug) {
+      Rcpp::Rcout << "Initializing the gradient" << std::endl;
+    }
 
-  // Initialize the inverse Hessian to a unit matrix
-  arma::mat hess_inv = arma::eye<arma::mat>(n_pars, n_pars);
+    func.Gradient(x, grad);
 
-  // Initialize Newton Step
-  arma::vec p = -hess_inv * grad;
+    // Initialize the inverse Hessian to the one kept by the last Optimize,
+    // or else to a unit matrix
+    rescale = warm_start_ && hess_inv_.n_rows == arma::uword(n_pars);
+    if (rescale)
+      hess_inv = hess_inv_;
+    else
+      hess_inv = arma::eye<arma::mat>(n_pars, n_pars);
 
-  // Calculate the maximum step length
-  double sum = sqrt(arma::dot(x, x));
-  const double kStepMax = kScaStepMax * std::max(sum, double(n_pars));
+    // Initialize Newton Step
+    p = -hess_inv * grad;
+  }
 
   // Main loop over the iterations
-  for (int iter = 0; iter != kIterMax; ++iter) {
+  for (int iter = first_iter; iter != kIterMax; ++iter) {
     n_iters_ = iter;
 
-    arma::vec x2 = x;  // Save the old point
+    if (checkpoint_every_ > 0 && iter != first_iter &&
+        iter % checkpoint_every_ == 0) {
+      Checkpoint state;
+      state.phase = 1;
+      state.iter = iter;
+      state.f = f;
+      state.stepmax = kStepMax;
+      state.x = x;
+      state.grad = grad;
+      state.p = p;
+      state.hess_inv = hess_inv;
+      save_(state);
+    }
+
+    arma::vec x2 = x;        // Save the old point
+    arma::vec grad2 = grad;  // Save the old gradient
 
-    this->GetStep(func, x, p, kStepMax);
+    // Update the point and the function value, and for the Wolfe search
+    // the gradient
+    if (this->wolfe_)
+      f = this->GetWolfeStep(func, x, p, kStepMax, f, grad);
+    else
+      f = this->GetStep(func, x, p, kStepMax, f, grad);
 
-    f = func(x);  // Update function value
-    p = x - x2;   // Update line direction
-    x2 = x;       // Update the current point
+    p = x - x2;  // Update line direction
+    x2 = x;      // Update the current point
     f_min_ = f;
 
     if (trace_) {
@@ -87,10 +134,12 @@ void BFGS<T>::Optimize(T &func, arma::vec &x, const double grad_tol) {
       double temp = std::abs(p(i)) / std::max(std::abs(x(i)), 1.0);
       if (temp > test) test = temp;
     }
-    if (test < kTolX) return;
+    if (test < kTolX) {
+      stop_reason_ = StopReason::kTolX;
+      return;
+    }
 
-    arma::vec grad2 = grad;  // Save the old gradient
-    func.Gradient(x, grad);  // Get the new gradient
+    if (!this->wolfe_) func.Gradient(x, grad);  // Get the new gradient
 
     // Test for convergence on zero gradient
     test = 0.0;
@@ -99,7 +148,10 @@ void BFGS<T>::Optimize(T &func, arma::vec &x, const double grad_tol) {
       double temp = std::abs(grad(i)) * std::max(std::abs(x(i)), 1.0) / den;
       if (temp > test) test = temp;
     }
-    if (test < grad_tol) return;
+    if (test < grad_tol) {
+      stop_reason_ = StopReason::kGradTol;
+      return;
+    }
 
     // Compute difference of gradients
     arma::vec dg = grad - grad2;
@@ -115,6 +167,15 @@ void BFGS<T>::Optimize(T &func, arma::vec &x, const double grad_tol) {
 
     // Skip update if fac not sufficiently positive
     if (fac > sqrt(kEpsilon * sumdg * sump)) {
+      // Scale a kept inverse Hessian to the curvature along the first step
+      if (rescale) {
+        double scale = fac / fae;
+        hess_inv *= scale;
+        hdg *= scale;
+        fae *= scale;
+        rescale = false;
+      }
+
       fac = 1.0 / fac;
       fad = 1.0 / fae;
 
@@ -122,11 +183,13 @@ void BFGS<T>::Optimize(T &func, arma::vec &x, const double grad_tol) {
       arma::vec u = fac * p - fad * hdg;
 
       hess_inv += fac * p * p.t() - fad * hdg * hdg.t() + fae * u * u.t();
+      if (warm_start_) hess_inv_ = hess_inv;
     }
 
     // Calculate the next direction to go
     p = -hess_inv * grad;
   }
+  stop_reason_ = StopReason::kMaxIter;
   if (this->message_) {
     Rcpp::Rcerr << "too many iterations in bfgs" << std::endl;
   }
@@ -0,0 +1,121 @@
+//  bootstrap.h: nonparametric bootstrap of the joint mean-covariance models
+//               (MCD/ACD/HPC)
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_SRC_BOOTSTRAP_H_
+#define JMCM_SRC_BOOTSTRAP_H_
+
+#define ARMA_DONT_PRINT_ERRORS
+#include <RcppArmadillo.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <random>
+
+#include "jmcm_base.h"
+#include "jmcm_fit.h"
+#include "parallel.h"
+
+namespace jmcm {
+
+// A resample of the subjects with replacement enters -2l(theta) only
+// through the number of times w_i each subject is drawn, as the sum of
+// w_i (-2l_i(theta)). The replicates are therefore fitted as weighted fits
+// to the original data (see JmcmBase::set_weights), all of them sharing one
+// JmcmData and none of them copying a subject block.
+
+// Counts w_i of the n_sub subjects in replicate b. The random stream of a
+// replicate is seeded by (seed, b) alone, so that the replicates do not
+// depend on the thread they run on or on the order they are run in.
+inline arma::vec ResampleWeights(arma::uword n_sub, std::uint32_t seed,
+                                 arma::uword b) {
+  std::uint64_t b64 = b;
+  std::seed_seq seq{seed, static_cast<std::uint32_t>(b64),
+                    static_cast<std::uint32_t>(b64 >> 32)};
+  std::mt19937_64 rng(seq);
+  std::uniform_int_distribution<arma::uword> draw(0, n_sub - 1);
+
+  arma::vec w = arma::zeros<arma::vec>(n_sub);
+  for (arma::uword k = 0; k != n_sub; ++k) ++w(draw(rng));
+
+  return w;
+}
+
+// Estimates of nboot bootstrap replicates, one per row, every fit starting
+// from theta. The replicates are spread over n_threads threads and each fit
+// runs on a single thread without printing. A replicate whose fit fails,
+// i.e. throws or ends at a point that is not finite, is a row of NaN and
+// has failed(b) = 1.
+template <typename JMCM>
+arma::mat Bootstrap(std::shared_ptr<const JmcmData> data,
+                    const arma::vec& theta, arma::uword nboot,
+                    std::uint32_t seed, int n_threads, arma::uvec& failed) {
+  arma::uword n_sub = data->m.n_elem;
+  arma::mat par(nboot, theta.n_elem);
+  failed = arma::zeros<arma::uvec>(nboot);
+
+  pan::ChunkPlan chunks(nboot, 1);
+  pan::ParallelFor(chunks.n_chunks(), n_threads, [&](arma::uword b) {
+    try {
+      JmcmFit<JMCM> fit(data, theta);
+      fit.set_weights(ResampleWeights(n_sub, seed, b));
+      par.row(b) = fit.Optimize().t();
+      if (!par.row(b).is_finite()) failed(b) = 1;
+    } catch (const std::exception&) {
+      failed(b) = 1;
+    }
+    if (failed(b)) par.row(b).fill(arma::datum::nan);
+  });
+
+  return par;
+}
+
+// Pointwise limits of the central level-interval of the curves, one curve
+// per row: with n sorted values at a point, the ceiling(n (1 - level) / 2)th
+// and the floor(n (1 + level) / 2)th, clamped to 1, ..., n. Returns the
+// lower and upper limits as the two columns of a matrix.
+inline arma::mat QuantileBands(const arma::mat& curves, double level) {
+  arma::uword n = curves.n_rows, n_points = curves.n_cols;
+  arma::mat band(n_points, 2);
+  if (n == 0) {
+    band.fill(arma::datum::nan);
+    return band;
+  }
+
+  double lower = std::ceil(n * (1 - level) / 2);
+  double upper = std::floor(n * (1 + level) / 2);
+  arma::uword k_lower = std::min<arma::uword>(
+      n - 1, static_cast<arma::uword>(std::max(lower, 1.0)) - 1);
+  arma::uword k_upper = std::min<arma::uword>(
+      n - 1, static_cast<arma::uword>(std::max(upper, 1.0)) - 1);
+
+  for (arma::uword t = 0; t != n_points; ++t) {
+    arma::vec v = arma::sort(curves.col(t));
+    band(t, 0) = v(k_lower);
+    band(t, 1) = v(k_upper);
+  }
+
+  return band;
+}
+
+}  // namespace jmcm
+
+#endif  // JMCM_SRC_BOOTSTRAP_H_
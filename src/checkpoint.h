@@ -0,0 +1,155 @@
+//  checkpoint.h: optimizer states saved to and restored from a file
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_SRC_CHECKPOINT_H_
+#define JMCM_SRC_CHECKPOINT_H_
+
+#define ARMA_DONT_PRINT_ERRORS
+#include <RcppArmadillo.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+namespace pan {
+
+// The state of an optimizer at the start of an iteration, from which the
+// iterations continue exactly as they would have without the interruption.
+// The state is only a function of the iterates, so a fit resumed from it
+// repeats the remaining iterates of the uninterrupted fit bit for bit.
+struct Checkpoint {
+  // phase 0 is the profile loop of JmcmFit, phase 1 BFGS over all the
+  // parameters; model is the method id of the fitted model
+  arma::uword phase = 0;
+  arma::uword model = 0;
+  arma::uword iter = 0;
+  double f = 0;
+  double stepmax = 0;  // maximum step length, fixed at the start of the fit
+  arma::vec x, grad, p;
+  arma::mat hess_inv;  // in the profile loop, the curvature kept by the
+                       // inner BFGS or L-BFGS (empty without warm start)
+  arma::vec counts;    // evaluation counters and backtracks of the fit
+  arma::vec inner;     // inner iterations of the outer iterations so far
+};
+
+namespace checkpoint_internal {
+
+// "jmcmckp" and the version of the layout
+const char kMagic[8] = {'j', 'm', 'c', 'm', 'c', 'k', 'p', '2'};
+
+inline void WriteUword(std::ofstream& out, arma::uword n) {
+  std::uint64_t v = n;
+  out.write(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+inline void WriteDoubles(std::ofstream& out, const double* v, arma::uword n) {
+  out.write(reinterpret_cast<const char*>(v), n * sizeof(double));
+}
+
+inline arma::uword ReadUword(std::ifstream& in) {
+  std::uint64_t v = 0;
+  in.read(reinterpret_cast<char*>(&v), sizeof(v));
+  return static_cast<arma::uword>(v);
+}
+
+inline void ReadDoubles(std::ifstream& in, double* v, arma::uword n) {
+  in.read(reinterpret_cast<char*>(v), n * sizeof(double));
+}
+
+inline void WriteVec(std::ofstream& out, const arma::vec& v) {
+  WriteUword(out, v.n_elem);
+  WriteDoubles(out, v.memptr(), v.n_elem);
+}
+
+inline arma::vec ReadVec(std::ifstream& in) {
+  arma::uword n = ReadUword(in);
+  if (!in || n > (1u << 24)) throw std::runtime_error("corrupt checkpoint");
+  arma::vec v(n);
+  ReadDoubles(in, v.memptr(), n);
+  return v;
+}
+
+}  // namespace checkpoint_internal
+
+// Writes state to file in native byte order, by way of a temporary file
+// renamed over it, so that an interruption while writing leaves the last
+// checkpoint intact
+inline void SaveCheckpoint(const std::string& file, const Checkpoint& state) {
+  using namespace checkpoint_internal;
+
+  std::string tmp = file + ".tmp";
+  {
+    std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(kMagic, sizeof(kMagic));
+    WriteUword(out, state.phase);
+    WriteUword(out, state.model);
+    WriteUword(out, state.iter);
+    WriteDoubles(out, &state.f, 1);
+    WriteDoubles(out, &state.stepmax, 1);
+    WriteVec(out, state.x);
+    WriteVec(out, state.grad);
+    WriteVec(out, state.p);
+    WriteUword(out, state.hess_inv.n_rows);
+    WriteUword(out, state.hess_inv.n_cols);
+    WriteDoubles(out, state.hess_inv.memptr(), state.hess_inv.n_elem);
+    WriteVec(out, state.counts);
+    WriteVec(out, state.inner);
+    if (!out) throw std::runtime_error("cannot write checkpoint " + tmp);
+  }
+  if (std::rename(tmp.c_str(), file.c_str()) != 0)
+    throw std::runtime_error("cannot write checkpoint " + file);
+}
+
+inline Checkpoint LoadCheckpoint(const std::string& file) {
+  using namespace checkpoint_internal;
+
+  std::ifstream in(file.c_str(), std::ios::binary);
+  if (!in) throw std::runtime_error("cannot read checkpoint " + file);
+
+  char magic[sizeof(kMagic)];
+  in.read(magic, sizeof(magic));
+  if (!in || !std::equal(magic, magic + sizeof(magic), kMagic))
+    throw std::runtime_error(file + " is not a jmcm checkpoint");
+
+  Checkpoint state;
+  state.phase = ReadUword(in);
+  state.model = ReadUword(in);
+  state.iter = ReadUword(in);
+  ReadDoubles(in, &state.f, 1);
+  ReadDoubles(in, &state.stepmax, 1);
+  state.x = ReadVec(in);
+  state.grad = ReadVec(in);
+  state.p = ReadVec(in);
+  arma::uword n_rows = ReadUword(in), n_cols = ReadUword(in);
+  if (!in || n_rows > (1u << 12) || n_cols > (1u << 12))
+    throw std::runtime_error("corrupt checkpoint");
+  state.hess_inv.set_size(n_rows, n_cols);
+  ReadDoubles(in, state.hess_inv.memptr(), state.hess_inv.n_elem);
+  state.counts = ReadVec(in);
+  state.inner = ReadVec(in);
+  if (!in) throw std::runtime_error("corrupt checkpoint");
+
+  return state;
+}
+
+}  // namespace pan
+
+#endif  // JMCM_SRC_CHECKPOINT_H_
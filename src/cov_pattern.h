@@ -0,0 +1,170 @@
+//  cov_pattern.h: groups of subjects sharing the same covariance structure
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_SRC_COV_PATTERN_H_
+#define JMCM_SRC_COV_PATTERN_H_
+
+#define ARMA_DONT_PRINT_ERRORS
+#include <RcppArmadillo.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "lag_table.h"
+#include "subject_index.h"
+
+namespace jmcm {
+
+// D_i, T_i and Sigma_i depend on subject i only through m_i, Z_i and the
+// rows of W_i, and the last two are functions of the visit times. Subjects
+// with the same times (a protocol schedule, possibly cut short by dropout
+// at the same visit) therefore share their covariance, and it only has to
+// be factored once per pattern. CovPattern finds the patterns by hashing
+// (m_i, Z_i, lag ids of W_i) and keeps, for every pattern, the subjects
+// in it, the first of them being the representative whose T_i is stored.
+class CovPattern {
+ public:
+  CovPattern() = default;
+  CovPattern(const SubjectIndex& index, const arma::mat& Z,
+             const LagTable& lags);
+
+  // the same patterns, with the counters starting from zero
+  CovPattern(const CovPattern& other)
+      : pattern_(other.pattern_),
+        rep_(other.rep_),
+        offset_(other.offset_),
+        subject_(other.subject_) {}
+
+  arma::uword n_sub() const { return pattern_.n_elem; }
+  arma::uword n_patterns() const { return rep_.n_elem; }
+
+  arma::uword pattern(arma::uword i) const { return pattern_(i); }
+  arma::uword rep(arma::uword i) const { return rep_(pattern_(i)); }
+
+  // subjects of pattern p are subject(s) for s = begin(p), ..., end(p) - 1
+  arma::uword rep_of(arma::uword p) const { return rep_(p); }
+  arma::uword begin(arma::uword p) const { return offset_(p); }
+  arma::uword end(arma::uword p) const { return offset_(p + 1); }
+  arma::uword size(arma::uword p) const { return offset_(p + 1) - offset_(p); }
+  arma::uword subject(arma::uword s) const { return subject_(s); }
+
+  // a sweep factors every pattern once and reuses it for the other
+  // subjects of the pattern; the counters are atomic as the patterns are
+  // shared by the evaluation contexts of a model
+  void RecordSweep() const {
+    n_factor_ += n_patterns();
+    n_reuse_ += n_sub() - n_patterns();
+  }
+  double n_factor() const { return static_cast<double>(n_factor_.load()); }
+  double n_reuse() const { return static_cast<double>(n_reuse_.load()); }
+  void ResetCounts() const {
+    n_factor_ = 0;
+    n_reuse_ = 0;
+  }
+
+ private:
+  arma::uvec pattern_;  // pattern of each subject
+  arma::uvec rep_;      // representative subject of each pattern
+  arma::uvec offset_;   // n_patterns + 1 entries into subject_
+  arma::uvec subject_;  // subjects grouped by pattern
+
+  mutable std::atomic<unsigned long long> n_factor_{0}, n_reuse_{0};
+
+  static bool SameBlock(const SubjectIndex& index, const arma::mat& Z,
+                        const LagTable& lags, arma::uword i, arma::uword j);
+};
+
+inline CovPattern::CovPattern(const SubjectIndex& index, const arma::mat& Z,
+                              const LagTable& lags)
+    : pattern_(index.n_sub()) {
+  arma::uword i, n_sub = index.n_sub();
+  std::unordered_multimap<std::size_t, arma::uword> seen;
+  std::vector<arma::uword> rep;
+
+  for (i = 0; i != n_sub; ++i) {
+    arma::uword mi = index.m(i), first_obs = index.obs_begin(i),
+                first_pair = index.pair_begin(i);
+
+    std::size_t h = std::hash<arma::uword>()(mi);
+    auto combine = [&h](std::size_t v) {
+      h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    };
+    for (arma::uword c = 0; c != Z.n_cols; ++c) {
+      for (arma::uword j = 0; j != mi; ++j) {
+        double z = Z(first_obs + j, c);
+        std::uint64_t bits;
+        std::memcpy(&bits, &z, sizeof(bits));
+        combine(std::hash<std::uint64_t>()(bits));
+      }
+    }
+    for (arma::uword p = 0; p != index.n_pairs(i); ++p)
+      combine(std::hash<arma::uword>()(lags.lag_id(first_pair + p)));
+
+    arma::uword id = rep.size();
+    auto range = seen.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (SameBlock(index, Z, lags, rep[it->second], i)) {
+        id = it->second;
+        break;
+      }
+    }
+    if (id == rep.size()) {
+      rep.push_back(i);
+      seen.emplace(h, id);
+    }
+    pattern_(i) = id;
+  }
+
+  arma::uword n_patterns = rep.size();
+  rep_ = arma::conv_to<arma::uvec>::from(rep);
+
+  // counting sort of the subjects by pattern, keeping their order
+  offset_ = arma::zeros<arma::uvec>(n_patterns + 1);
+  for (i = 0; i != n_sub; ++i) ++offset_(pattern_(i) + 1);
+  offset_ = arma::cumsum(offset_);
+
+  subject_.set_size(n_sub);
+  arma::uvec next = offset_.head(n_patterns);
+  for (i = 0; i != n_sub; ++i) subject_(next(pattern_(i))++) = i;
+}
+
+inline bool CovPattern::SameBlock(const SubjectIndex& index,
+                                  const arma::mat& Z, const LagTable& lags,
+                                  arma::uword i, arma::uword j) {
+  arma::uword mi = index.m(i);
+  if (index.m(j) != mi) return false;
+
+  arma::uword first_i = index.obs_begin(i), first_j = index.obs_begin(j);
+  for (arma::uword c = 0; c != Z.n_cols; ++c)
+    for (arma::uword k = 0; k != mi; ++k)
+      if (Z(first_i + k, c) != Z(first_j + k, c)) return false;
+
+  first_i = index.pair_begin(i);
+  first_j = index.pair_begin(j);
+  for (arma::uword p = 0; p != index.n_pairs(i); ++p)
+    if (lags.lag_id(first_i + p) != lags.lag_id(first_j + p)) return false;
+
+  return true;
+}
+
+}  // namespace jmcm
+
+#endif  // JMCM_SRC_COV_PATTERN_H_
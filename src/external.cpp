@@ -21,9 +21,43 @@
 // [[Rcpp::depends(RcppArmadillo)]]
 
 #include "acd.h"
+#include "bootstrap.h"
 #include "hpc.h"
 #include "jmcm_fit.h"
 #include "mcd.h"
+#include "model_search.h"
+#include "start_values.h"
+
+// The telemetry of a fit returned by the *_estimation functions: the
+// evaluations and line search backtracks, the inner iterations of the outer
+// iterations of the profile fit and those saved by the warm start, the wall
+// time of its phases, the gradient norms of the blocks at the result and
+// why the fit stopped
+template <typename JMCM>
+Rcpp::List FitTelemetry(const JmcmFit<JMCM>& fit) {
+  const jmcm::EvalCounts& evals = fit.get_eval_counts();
+  const pan::PhaseTimes& times = fit.get_times();
+  const arma::vec& grad_norm = fit.get_grad_norm();
+
+  return Rcpp::List::create(
+      Rcpp::Named("counts") = Rcpp::NumericVector::create(
+          Rcpp::Named("value") = evals.n_value,
+          Rcpp::Named("gradient") = evals.n_gradient,
+          Rcpp::Named("update") = evals.n_update,
+          Rcpp::Named("backtrack") = fit.get_n_backtracks()),
+      Rcpp::Named("inner") = fit.get_inner_iters(),
+      Rcpp::Named("inner_saved") = fit.get_inner_saved(),
+      Rcpp::Named("times") = Rcpp::NumericVector::create(
+          Rcpp::Named("beta") = times.beta,
+          Rcpp::Named("covariance") = times.covariance,
+          Rcpp::Named("line_search") = times.line_search,
+          Rcpp::Named("total") = times.total),
+      Rcpp::Named("grad_norm") = Rcpp::NumericVector::create(
+          Rcpp::Named("beta") = grad_norm(0),
+          Rcpp::Named("lambda") = grad_norm(1),
+          Rcpp::Named("gamma") = grad_norm(2)),
+      Rcpp::Named("convergence") = pan::StopReasonName(fit.get_stop_reason()));
+}
 
 //'@title Fit Joint Mean-Covariance Models based on MCD
 //'@description Fit joint mean-covariance models based on MCD.
@@ -40,8 +74,25 @@
 //'       idea of profile likelihood or not.
 //'@param errormsg whether or not the error message should be print.
 //'@param covonly estimate the covariance structure only, and use given mean.
-//'@param optim_method optimization method, choose "default" or "BFGS"(vmmin in
-//'       R).
+//'@param optim_method optimization method, choose "default", "BFGS"(vmmin in
+//'       R), "lbfgs" (limited-memory BFGS, for wide designs) or "trust"
+//'       (trust-region Newton, for ill-conditioned fits).
+//'@param n_threads number of threads used for the loops over subjects.
+//'@param lbfgs_history number of past steps kept by "lbfgs".
+//'@param line_search line search of the quasi-Newton iterations,
+//'       "backtracking" or "wolfe" (strong Wolfe conditions).
+//'@param checkpoint file the state of the optimizer is saved to, "" for
+//'       none. Only the profile fit and the default method without profile
+//'       are checkpointed.
+//'@param checkpoint_every number of iterations between checkpoints.
+//'@param resume checkpoint file the fit continues from, "" to start at
+//'       start. The fit repeats the remaining iterates of the interrupted
+//'       one.
+//'@param warm_start whether the updates of the covariance parameters by
+//'       BFGS or L-BFGS in the profile fit start from the curvature of the
+//'       previous outer iteration.
+//'@param trust_hessian model Hessian of "trust", "exact" (in closed form)
+//'       or "bfgs" (quasi-Newton approximation).
 //'@seealso \code{\link{acd_estimation}} for joint mean covariance model fitting
 //'         based on ACD, \code{\link{hpc_estimation}} for joint mean covariance
 //'         model fitting based on HPC.
@@ -51,9 +102,22 @@ Rcpp::List mcd_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z,
                           arma::mat W, arma::vec start, arma::vec mean,
                           bool trace = false, bool profile = true,
                           bool errormsg = false, bool covonly = false,
-                          std::string optim_method = "default") {
+                          std::string optim_method = "default",
+                          int n_threads = 1, int lbfgs_history = 6,
+                          std::string line_search = "backtracking",
+                          std::string checkpoint = "",
+                          int checkpoint_every = 10,
+                          std::string resume = "",
+                          bool warm_start = true,
+                          std::string trust_hessian = "exact") {
   JmcmFit<jmcm::MCD> fit(m, Y, X, Z, W, start, mean, trace, profile, errormsg,
-                         covonly, optim_method);
+                         covonly, optim_method, n_threads);
+  fit.set_lbfgs_history(lbfgs_history);
+  fit.set_line_search(line_search);
+  fit.set_checkpoint(checkpoint, checkpoint_every);
+  fit.set_resume(resume);
+  fit.set_warm_start(warm_start);
+  fit.set_trust_hessian(trust_hessian);
   arma::vec x = fit.Optimize();
   double f_min = fit.get_f_min();
   arma::uword n_iters = fit.get_n_iters();
@@ -75,7 +139,8 @@ Rcpp::List mcd_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z,
       Rcpp::Named("loglik") = -f_min / 2,
       Rcpp::Named("BIC") =
           f_min / n_sub + n_par * log(static_cast<double>(n_sub)) / n_sub,
-      Rcpp::Named("iter") = n_iters);
+      Rcpp::Named("iter") = n_iters,
+      Rcpp::Named("telemetry") = FitTelemetry(fit));
 }
 
 //'@title Fit Joint Mean-Covariance Models based on ACD
@@ -93,8 +158,25 @@ Rcpp::List mcd_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z,
 //'       idea of profile likelihood or not.
 //'@param errormsg whether or not the error message should be print.
 //'@param covonly estimate the covariance structure only, and use given mean.
-//'@param optim_method optimization method, choose "default" or "BFGS"(vmmin in
-//'       R).
+//'@param optim_method optimization method, choose "default", "BFGS"(vmmin in
+//'       R), "lbfgs" (limited-memory BFGS, for wide designs) or "trust"
+//'       (trust-region Newton, for ill-conditioned fits).
+//'@param n_threads number of threads used for the loops over subjects.
+//'@param lbfgs_history number of past steps kept by "lbfgs".
+//'@param line_search line search of the quasi-Newton iterations,
+//'       "backtracking" or "wolfe" (strong Wolfe conditions).
+//'@param checkpoint file the state of the optimizer is saved to, "" for
+//'       none. Only the profile fit and the default method without profile
+//'       are checkpointed.
+//'@param checkpoint_every number of iterations between checkpoints.
+//'@param resume checkpoint file the fit continues from, "" to start at
+//'       start. The fit repeats the remaining iterates of the interrupted
+//'       one.
+//'@param warm_start whether the updates of the covariance parameters by
+//'       BFGS or L-BFGS in the profile fit start from the curvature of the
+//'       previous outer iteration.
+//'@param trust_hessian model Hessian of "trust", "exact" (in closed form)
+//'       or "bfgs" (quasi-Newton approximation).
 //'@seealso \code{\link{mcd_estimation}} for joint mean covariance model fitting
 //'         based on MCD, \code{\link{hpc_estimation}} for joint mean covariance
 //'         model fitting based on HPC.
@@ -104,9 +186,22 @@ Rcpp::List acd_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z,
                           arma::mat W, arma::vec start, arma::vec mean,
                           bool trace = false, bool profile = true,
                           bool errormsg = false, bool covonly = false,
-                          std::string optim_method = "default") {
+                          std::string optim_method = "default",
+                          int n_threads = 1, int lbfgs_history = 6,
+                          std::string line_search = "backtracking",
+                          std::string checkpoint = "",
+                          int checkpoint_every = 10,
+                          std::string resume = "",
+                          bool warm_start = true,
+                          std::string trust_hessian = "exact") {
   JmcmFit<jmcm::ACD> fit(m, Y, X, Z, W, start, mean, trace, profile, errormsg,
-                         covonly, optim_method);
+                         covonly, optim_method, n_threads);
+  fit.set_lbfgs_history(lbfgs_history);
+  fit.set_line_search(line_search);
+  fit.set_checkpoint(checkpoint, checkpoint_every);
+  fit.set_resume(resume);
+  fit.set_warm_start(warm_start);
+  fit.set_trust_hessian(trust_hessian);
   arma::vec x = fit.Optimize();
   double f_min = fit.get_f_min();
   arma::uword n_iters = fit.get_n_iters();
@@ -128,7 +223,8 @@ Rcpp::List acd_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z,
       Rcpp::Named("loglik") = -f_min / 2,
       Rcpp::Named("BIC") =
           f_min / n_sub + n_par * log(static_cast<double>(n_sub)) / n_sub,
-      Rcpp::Named("iter") = n_iters);
+      Rcpp::Named("iter") = n_iters,
+      Rcpp::Named("telemetry") = FitTelemetry(fit));
 }
 
 //'@title Fit Joint Mean-Covariance Models based on HPC
@@ -146,8 +242,25 @@ Rcpp::List acd_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z,
 //'       idea of profile likelihood or not.
 //'@param errormsg whether or not the error message should be print.
 //'@param covonly estimate the covariance structure only, and use given mean.
-//'@param optim_method optimization method, choose "default" or "BFGS"(vmmin in
-//'       R).
+//'@param optim_method optimization method, choose "default", "BFGS"(vmmin in
+//'       R), "lbfgs" (limited-memory BFGS, for wide designs) or "trust"
+//'       (trust-region Newton, for ill-conditioned fits).
+//'@param n_threads number of threads used for the loops over subjects.
+//'@param lbfgs_history number of past steps kept by "lbfgs".
+//'@param line_search line search of the quasi-Newton iterations,
+//'       "backtracking" or "wolfe" (strong Wolfe conditions).
+//'@param checkpoint file the state of the optimizer is saved to, "" for
+//'       none. Only the profile fit and the default method without profile
+//'       are checkpointed.
+//'@param checkpoint_every number of iterations between checkpoints.
+//'@param resume checkpoint file the fit continues from, "" to start at
+//'       start. The fit repeats the remaining iterates of the interrupted
+//'       one.
+//'@param warm_start whether the updates of the covariance parameters by
+//'       BFGS or L-BFGS in the profile fit start from the curvature of the
+//'       previous outer iteration.
+//'@param trust_hessian model Hessian of "trust", "exact" (in closed form)
+//'       or "bfgs" (quasi-Newton approximation).
 //'@seealso \code{\link{mcd_estimation}} for joint mean covariance model fitting
 //'         based on MCD, \code{\link{acd_estimation}} for joint mean covariance
 //'         model fitting based on ACD.
@@ -157,9 +270,22 @@ Rcpp::List hpc_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z,
                           arma::mat W, arma::vec start, arma::vec mean,
                           bool trace = false, bool profile = true,
                           bool errormsg = false, bool covonly = false,
-                          std::string optim_method = "default") {
+                          std::string optim_method = "default",
+                          int n_threads = 1, int lbfgs_history = 6,
+                          std::string line_search = "backtracking",
+                          std::string checkpoint = "",
+                          int checkpoint_every = 10,
+                          std::string resume = "",
+                          bool warm_start = true,
+                          std::string trust_hessian = "exact") {
   JmcmFit<jmcm::HPC> fit(m, Y, X, Z, W, start, mean, trace, profile, errormsg,
-                         covonly, optim_method);
+                         covonly, optim_method, n_threads);
+  fit.set_lbfgs_history(lbfgs_history);
+  fit.set_line_search(line_search);
+  fit.set_checkpoint(checkpoint, checkpoint_every);
+  fit.set_resume(resume);
+  fit.set_warm_start(warm_start);
+  fit.set_trust_hessian(trust_hessian);
   arma::vec x = fit.Optimize();
   double f_min = fit.get_f_min();
   arma::uword n_iters = fit.get_n_iters();
@@ -181,7 +307,211 @@ Rcpp::List hpc_estimation(arma::vec m, arma::vec Y, arma::mat X, arma::mat Z,
       Rcpp::Named("loglik") = -f_min / 2,
       Rcpp::Named("BIC") =
           f_min / n_sub + n_par * log(static_cast<double>(n_sub)) / n_sub,
-      Rcpp::Named("iter") = n_iters);
+      Rcpp::Named("iter") = n_iters,
+      Rcpp::Named("telemetry") = FitTelemetry(fit));
+}
+
+//'@title Start Values of Joint Mean-Covariance Models
+//'@description Compute the starting values of the parameters of a joint
+//'             mean-covariance model.
+//'@param method covariance structure, "mcd", "acd" or "hpc".
+//'@param m an integer vector of numbers of measurements for subject.
+//'@param Y a vector of responses for all subjects.
+//'@param X model matrix for the mean structure model.
+//'@param Z model matrix for the diagonal matrix.
+//'@param W model matrix for the lower triangular matrix.
+//'@param strategy "ols" regresses the log squared residuals of the least
+//'       squares fit of the mean on Z, with gamma at zero (the first angle
+//'       at pi / 2 for "hpc"); "moment" fits lambda and gamma to the sample
+//'       regressogram of the residuals, binned by visit when the data are
+//'       unbalanced, and falls back to "ols" if their covariance is not
+//'       positive definite.
+//'@return The starting values (beta, lambda, gamma).
+//'@export
+// [[Rcpp::export]]
+arma::vec start_values(std::string method, arma::vec m, arma::vec Y,
+                       arma::mat X, arma::mat Z, arma::mat W,
+                       std::string strategy = "ols") {
+  arma::uword method_id;
+  if (method == "mcd")
+    method_id = 0;
+  else if (method == "acd")
+    method_id = 1;
+  else if (method == "hpc")
+    method_id = 2;
+  else
+    Rcpp::stop("method must be one of \"mcd\", \"acd\" or \"hpc\"");
+
+  jmcm::JmcmData data(m, Y, X, Z, W);
+  if (strategy == "ols") return jmcm::OlsStart(data, method_id);
+  if (strategy == "moment") return jmcm::MomentStart(data, method_id);
+  Rcpp::stop("strategy must be \"ols\" or \"moment\"");
+}
+
+//'@title Bootstrap Joint Mean-Covariance Models
+//'@description Fit a joint mean-covariance model to bootstrap resamples of
+//'             the subjects, and compute pointwise bootstrap bands for its
+//'             fitted curves.
+//'@param method covariance structure, "mcd", "acd" or "hpc".
+//'@param m an integer vector of numbers of measurements for subject.
+//'@param Y a vector of responses for all subjects.
+//'@param X model matrix for the mean structure model.
+//'@param Z model matrix for the diagonal matrix.
+//'@param W model matrix for the lower triangular matrix.
+//'@param theta the fitted parameters, used as starting values of every
+//'       replicate.
+//'@param nboot number of the bootstrap replications.
+//'@param seed seed of the random number streams of the replicates. Replicate
+//'       b only depends on seed and b, so that the result does not depend on
+//'       n_threads.
+//'@param n_threads number of threads the replicates are run on.
+//'@param X_curve model matrix of the mean curve at the points it is drawn at.
+//'@param Z_curve model matrix of the log-(innovation) variance curve at the
+//'       points it is drawn at.
+//'@param W_curve model matrix of the curve of the lower triangular matrix at
+//'       the lags it is drawn at.
+//'@param level coverage of the pointwise bands.
+//'@return A list with the estimates par of the replicates (one per row, NaN
+//'        for a replicate whose fit failed), the number failed of failed
+//'        replicates and their indices failed_rows, and the bands mean, lambda
+//'        and gamma of the three curves over the other replicates, each a
+//'        matrix of lower and upper limits.
+//'@seealso \code{\link{bootcurve}} for plotting the bands.
+//'@export
+// [[Rcpp::export]]
+Rcpp::List bootstrap_estimation(std::string method, arma::vec m, arma::vec Y,
+                                arma::mat X, arma::mat Z, arma::mat W,
+                                arma::vec theta, int nboot, int seed,
+                                int n_threads, arma::mat X_curve,
+                                arma::mat Z_curve, arma::mat W_curve,
+                                double level = 0.95) {
+  if (nboot < 1) Rcpp::stop("nboot must be a positive integer");
+
+  // the resamples are subject weights on a single copy of the data
+  auto data = std::make_shared<const jmcm::JmcmData>(m, Y, X, Z, W);
+  std::uint32_t seed32 = static_cast<std::uint32_t>(seed);
+
+  arma::mat par;
+  arma::uvec failed;
+  if (method == "mcd")
+    par = jmcm::Bootstrap<jmcm::MCD>(data, theta, nboot, seed32, n_threads,
+                                     failed);
+  else if (method == "acd")
+    par = jmcm::Bootstrap<jmcm::ACD>(data, theta, nboot, seed32, n_threads,
+                                     failed);
+  else if (method == "hpc")
+    par = jmcm::Bootstrap<jmcm::HPC>(data, theta, nboot, seed32, n_threads,
+                                     failed);
+  else
+    Rcpp::stop("method must be one of \"mcd\", \"acd\" or \"hpc\"");
+
+  int n_bta = X.n_cols;
+  int n_lmd = Z.n_cols;
+  int n_gma = W.n_cols;
+
+  arma::uvec ok = arma::find(failed == 0);
+  arma::mat par_ok = par.rows(ok);
+  // 1-based, for R
+  std::vector<int> failed_rows;
+  for (arma::uword b = 0; b != failed.n_elem; ++b)
+    if (failed(b)) failed_rows.push_back(static_cast<int>(b) + 1);
+  arma::mat beta = par_ok.cols(0, n_bta - 1);
+  arma::mat lambda = par_ok.cols(n_bta, n_bta + n_lmd - 1);
+  arma::mat gamma = par_ok.cols(n_bta + n_lmd, n_bta + n_lmd + n_gma - 1);
+
+  return Rcpp::List::create(
+      Rcpp::Named("par") = par,
+      Rcpp::Named("failed") = static_cast<int>(arma::accu(failed)),
+      Rcpp::Named("failed_rows") = failed_rows,
+      Rcpp::Named("mean") = jmcm::QuantileBands(beta * X_curve.t(), level),
+      Rcpp::Named("lambda") =
+          jmcm::QuantileBands(lambda * Z_curve.t(), level),
+      Rcpp::Named("gamma") =
+          jmcm::QuantileBands(gamma * W_curve.t(), level));
+}
+
+//'@title Fit a Grid of Joint Mean-Covariance Models
+//'@description Fit the joint mean-covariance models of all the triples
+//'             (p, d, q) with 1 <= p <= P, 1 <= d <= D and 1 <= q <= Q, for
+//'             each of the given covariance structures.
+//'@param m an integer vector of numbers of measurements for subject.
+//'@param Y a vector of responses for all subjects.
+//'@param X model matrix for the mean structure model of the triple
+//'       max_triple, its polynomial columns first.
+//'@param Z model matrix for the diagonal matrix of the triple max_triple,
+//'       its polynomial columns first.
+//'@param W model matrix for the lower triangular matrix of the triple
+//'       max_triple.
+//'@param max_triple the largest degrees (P, D, Q) of the polynomials.
+//'@param methods covariance structures, any of "mcd", "acd" and "hpc".
+//'@param start starting values of beta and lambda for the triple (1, 1, 1).
+//'       The other models start from the fit of a smaller neighbour.
+//'@param n_threads number of threads the models are fitted on.
+//'@return A list with the covariance structure method, the triple p, d, q,
+//'        the log-likelihood loglik, BIC, the number of iterations iter and
+//'        the estimates par of every model, and whether its fit failed. A
+//'        model whose fit failed has NaN loglik and BIC, and its starting
+//'        values as par.
+//'@seealso \code{\link{jmcmSearch}} for the model selection based on it.
+//'@export
+// [[Rcpp::export]]
+Rcpp::List search_estimation(arma::vec m, arma::vec Y, arma::mat X,
+                             arma::mat Z, arma::mat W, arma::uvec max_triple,
+                             std::vector<std::string> methods, arma::vec start,
+                             int n_threads = 1) {
+  if (max_triple.n_elem != 3 || arma::any(max_triple < 1))
+    Rcpp::stop("max_triple must be three positive integers");
+  if (X.n_cols <= max_triple(0) || Z.n_cols <= max_triple(1) ||
+      W.n_cols != max_triple(2) + 1)
+    Rcpp::stop("The model matrices do not match max_triple");
+
+  arma::uvec method_ids(methods.size());
+  for (std::size_t j = 0; j != methods.size(); ++j) {
+    if (methods[j] == "mcd")
+      method_ids(j) = 0;
+    else if (methods[j] == "acd")
+      method_ids(j) = 1;
+    else if (methods[j] == "hpc")
+      method_ids(j) = 2;
+    else
+      Rcpp::stop("methods must be \"mcd\", \"acd\" or \"hpc\"");
+  }
+
+  auto data = std::make_shared<const jmcm::JmcmData>(m, Y, X, Z, W);
+  jmcm::ModelSearch search(data, max_triple, method_ids, start);
+  search.Run(n_threads);
+
+  const char* names[] = {"mcd", "acd", "hpc"};
+  arma::uword n_fits = search.n_fits();
+  double n_sub = m.n_elem;
+  Rcpp::CharacterVector method(n_fits);
+  Rcpp::IntegerVector p(n_fits), d(n_fits), q(n_fits), iter(n_fits);
+  Rcpp::NumericVector loglik(n_fits), bic(n_fits);
+  Rcpp::LogicalVector failed(n_fits);
+  Rcpp::List par(n_fits);
+  for (arma::uword k = 0; k != n_fits; ++k) {
+    arma::uvec t = search.triple(k);
+    double f_min = search.f_min(k);
+    int n_par = search.theta(k).n_elem;
+
+    method[k] = names[search.method_id(k)];
+    p[k] = t(0);
+    d[k] = t(1);
+    q[k] = t(2);
+    loglik[k] = -f_min / 2;
+    bic[k] = f_min / n_sub + n_par * log(n_sub) / n_sub;
+    iter[k] = search.n_iters(k);
+    failed[k] = search.failed(k);
+    par[k] = Rcpp::NumericVector(search.theta(k).begin(),
+                                 search.theta(k).end());
+  }
+
+  return Rcpp::List::create(
+      Rcpp::Named("method") = method, Rcpp::Named("p") = p,
+      Rcpp::Named("d") = d, Rcpp::Named("q") = q,
+      Rcpp::Named("loglik") = loglik, Rcpp::Named("BIC") = bic,
+      Rcpp::Named("iter") = iter, Rcpp::Named("failed") = failed,
+      Rcpp::Named("par") = par);
 }
 
 RcppExport SEXP MCD__new(SEXP m_, SEXP Y_, SEXP X_, SEXP Z_, SEXP W_) {
@@ -332,3 +662,74 @@ RcppExport SEXP hess(SEXP xp, SEXP x_) {
   
   return Rcpp::wrap(hess);
 }
+
+RcppExport SEXP get_information(SEXP xp, SEXP x_) {
+  Rcpp::XPtr<jmcm::JmcmBase> ptr(xp);
+
+  arma::vec x = Rcpp::as<arma::vec>(x_);
+
+  arma::mat info;
+  ptr->Information(x, info);
+
+  return Rcpp::wrap(info);
+}
+
+RcppExport SEXP get_patterns(SEXP xp, SEXP x_) {
+  Rcpp::XPtr<jmcm::JmcmBase> ptr(xp);
+
+  arma::vec x = Rcpp::as<arma::vec>(x_);
+
+  // counts of one evaluation of -2l(theta) and its gradient at x
+  const jmcm::CovPattern& patterns = ptr->get_patterns();
+  patterns.ResetCounts();
+  ptr->operator()(x);
+  arma::vec grad;
+  ptr->Gradient(x, grad);
+
+  arma::uword n_patterns = patterns.n_patterns();
+  arma::uvec size(n_patterns);
+  for (arma::uword p = 0; p != n_patterns; ++p) size(p) = patterns.size(p);
+
+  return Rcpp::List::create(
+      Rcpp::Named("n_sub") = static_cast<int>(patterns.n_sub()),
+      Rcpp::Named("n_patterns") = static_cast<int>(n_patterns),
+      Rcpp::Named("balanced") = ptr->is_balanced(),
+      Rcpp::Named("size") = size,
+      Rcpp::Named("factorizations") = patterns.n_factor(),
+      Rcpp::Named("reuses") = patterns.n_reuse());
+}
+
+RcppExport SEXP get_load_balance(SEXP xp, SEXP x_) {
+  Rcpp::XPtr<jmcm::JmcmBase> ptr(xp);
+
+  arma::vec x = Rcpp::as<arma::vec>(x_);
+
+  // busy times of the threads in one evaluation of -2l(theta) and its
+  // gradient at x, on all the threads available; the model keeps the
+  // threads of the fit for any later call
+  int n_threads = ptr->get_n_threads();
+  ptr->set_n_threads(pan::MaxThreads());
+  ptr->ResetLoadStats();
+  int n_used = ptr->get_n_threads();
+  try {
+    ptr->operator()(x);
+    arma::vec grad;
+    ptr->Gradient(x, grad);
+  } catch (...) {
+    ptr->set_n_threads(n_threads);
+    throw;
+  }
+  ptr->set_n_threads(n_threads);
+
+  const pan::LoadStats& stats = ptr->get_load_stats();
+  return Rcpp::List::create(
+      Rcpp::Named("n_threads") = n_used,
+      Rcpp::Named("subject_chunks") =
+          static_cast<int>(ptr->get_subject_plan().n_chunks()),
+      Rcpp::Named("pattern_chunks") =
+          static_cast<int>(ptr->get_pattern_plan().n_chunks()),
+      Rcpp::Named("loops") = stats.n_loops,
+      Rcpp::Named("max_busy") = stats.max_busy,
+      Rcpp::Named("mean_busy") = stats.mean_busy,
+      Rcpp::Named("imbalance") = stats.imbalance());
+}
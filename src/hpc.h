@@ -24,12 +24,14 @@
 #include <cmath>
 
 #include <algorithm>  // std::equal
+#include <memory>
 
 #define ARMA_DONT_PRINT_ERRORS
 #include <RcppArmadillo.h>
 
 #include "arma_util.h"
 #include "jmcm_base.h"
+#include "packed_tri.h"
 
 namespace jmcm {
 
@@ -41,6 +43,7 @@ class HPC : public JmcmBase {
 
   HPC(const arma::vec& m, const arma::vec& Y, const arma::mat& X,
       const arma::mat& Z, const arma::mat& W);
+  explicit HPC(std::shared_ptr<const JmcmData> data);
 
   void UpdateLambdaGamma(const arma::vec& x) override;
 
@@ -63,6 +66,8 @@ class HPC : public JmcmBase {
   void get_Sigma_inv(arma::uword i, arma::mat& Sigmai_inv) const;
   void get_Resid(arma::uword i, arma::vec& ri) const;
 
+  using JmcmBase::operator();
+  using JmcmBase::Gradient;
   double operator()(const arma::vec& x) override;
   void Gradient(const arma::vec& x, arma::vec& grad) override;
   void Grad1(arma::vec& grad1);
@@ -78,29 +83,44 @@ class HPC : public JmcmBase {
   arma::vec TDResid_;
   arma::vec TDResid2_;
 
+  void Whiten(arma::uword i, double* v) const override;
+  void FactorDerivs(arma::uword i, arma::mat& B, arma::cube& dB,
+                    arma::cube* d2B) const override;
+  std::unique_ptr<JmcmBase> NewState() const override {
+    return std::unique_ptr<JmcmBase>(new HPC(data_));
+  }
+
+  // T_i and T_i^{-1} read in place from the packed Telem_ and invTelem_
+  pan::PackedLowerTri packed_T(arma::uword i) const {
+    return pan::PackedLowerTri(Telem_.memptr() + index_.tri_begin(cov_rep(i)),
+                               m_(i), true);
+  }
+  pan::PackedLowerTri packed_invT(arma::uword i) const {
+    return pan::PackedLowerTri(
+        invTelem_.memptr() + index_.tri_begin(cov_rep(i)), m_(i), true);
+  }
+
   arma::vec get_TDResid(arma::uword i) const;
   arma::vec get_TDResid2(arma::uword i) const;
   void get_TDResid(arma::uword i, arma::vec& TiDiri) const;
   void get_TDResid2(arma::uword i, arma::vec& TiDiri2) const;
+  const arma::vec view_TDResid(arma::uword i) const;
+  const arma::vec view_TDResid2(arma::uword i) const;
 
   void UpdateTelem();
   void UpdateTDResid();
-
-  arma::vec Wijk(arma::uword i, arma::uword j, arma::uword k);
-  arma::vec CalcTijkDeriv(arma::uword i, arma::uword j, arma::uword k,
-                          const arma::mat& Phii, const arma::mat& Ti);
-  arma::mat CalcTransTiDeriv(arma::uword i, const arma::mat& Phii,
-                             const arma::mat& Ti);
-
 };  // class HPC
 
 inline HPC::HPC(const arma::vec& m, const arma::vec& Y, const arma::mat& X,
                 const arma::mat& Z, const arma::mat& W)
-    : JmcmBase(m, Y, X, Z, W, 2) {
+    : HPC(std::make_shared<JmcmData>(m, Y, X, Z, W)) {}
+
+inline HPC::HPC(std::shared_ptr<const JmcmData> data)
+    : JmcmBase(std::move(data), 2) {
   arma::uword N = Y_.n_rows;
 
-  Telem_ = arma::zeros<arma::vec>(W_.n_rows + N);
-  invTelem_ = arma::zeros<arma::vec>(W_.n_rows + N);
+  Telem_ = arma::zeros<arma::vec>(lags_.n_pairs() + N);
+  invTelem_ = arma::zeros<arma::vec>(lags_.n_pairs() + N);
 
   TDResid_ = arma::zeros<arma::vec>(N);
   TDResid2_ = arma::zeros<arma::vec>(N);
@@ -111,20 +131,10 @@ inline void HPC::UpdateLambdaGamma(const arma::vec& x) { set_lmdgma(x); }
 inline arma::mat HPC::get_Phi(arma::uword i) const {
   arma::mat Phii = arma::zeros<arma::mat>(m_(i), m_(i));
   if (m_(i) != 1) {
-    if (i == 0) {
-      arma::uword first_index = 0;
-      arma::uword last_index = m_(0) * (m_(0) - 1) / 2 - 1;
-
-      Phii = pan::ltrimat(m_(0), Wgma_.subvec(first_index, last_index), false);
-    } else {
-      arma::uword first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) - 1) / 2;
-      }
-      arma::uword last_index = first_index + m_(i) * (m_(i) - 1) / 2 - 1;
+    arma::uword first_index = index_.pair_begin(i);
+    arma::uword last_index = first_index + index_.n_pairs(i) - 1;
 
-      Phii = pan::ltrimat(m_(i), Wgma_.subvec(first_index, last_index), false);
-    }
+    Phii = pan::ltrimat(m_(i), Wgma_.subvec(first_index, last_index), false);
   }
   return Phii;
 }
@@ -136,46 +146,18 @@ inline arma::mat HPC::get_R(arma::uword i) const {
 }
 
 inline arma::mat HPC::get_D(arma::uword i) const {
-  arma::mat Di = arma::eye(m_(i), m_(i));
-  if (i == 0)
-    Di = arma::diagmat(arma::exp(Zlmd_.subvec(0, m_(0) - 1) / 2));
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    Di = arma::diagmat(arma::exp(Zlmd_.subvec(index, index + m_(i) - 1) / 2));
-  }
-  return Di;
+  arma::uword first_index = index_.obs_begin(i);
+  return arma::diagmat(
+      arma::exp(Zlmd_.subvec(first_index, first_index + m_(i) - 1) / 2));
 }
 
 inline arma::mat HPC::get_T(arma::uword i) const {
-  arma::mat Ti = arma::eye(m_(i), m_(i));
-  if (m_(i) != 1) {
-    if (i == 0) {
-      arma::uword first_index = 0;
-      arma::uword last_index = m_(0) * (m_(0) + 1) / 2 - 1;
-
-      Ti = pan::ltrimat(m_(0), Telem_.subvec(first_index, last_index), true);
-    } else {
-      arma::uword first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) + 1) / 2;
-      }
-      arma::uword last_index = first_index + m_(i) * (m_(i) + 1) / 2 - 1;
-
-      Ti = pan::ltrimat(m_(i), Telem_.subvec(first_index, last_index), true);
-    }
-  }
-  return Ti;
+  return packed_T(i).Unpack();
 }
 
 inline arma::vec HPC::get_mu(arma::uword i) const {
-  arma::vec mui;
-  if (i == 0)
-    mui = Xbta_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    mui = Xbta_.subvec(index, index + m_(i) - 1);
-  }
-  return mui;
+  arma::uword first_index = index_.obs_begin(i);
+  return Xbta_.subvec(first_index, first_index + m_(i) - 1);
 }
 
 inline arma::mat HPC::get_Sigma(arma::uword i) const {
@@ -186,44 +168,27 @@ inline arma::mat HPC::get_Sigma(arma::uword i) const {
 }
 
 inline arma::mat HPC::get_Sigma_inv(arma::uword i) const {
-  arma::mat Ti = get_T(i);
-  // arma::mat Ti_inv = arma::pinv(Ti);
-  arma::mat Ti_inv = Ti.i();
+  // T_i^{-1} is kept up to date by UpdateTelem, and with
+  // B = T_i^{-1} D_i^{-1}: Sigma_i^{-1} = B' B
+  arma::mat B;
+  get_invT(i, B);
+  B.each_row() %= arma::exp(-view_Zlmd(i) / 2).t();
 
-  arma::mat Di = get_D(i);
-  arma::mat Di_inv = arma::diagmat(arma::pow(Di.diag(), -1));
-
-  return Di_inv * Ti_inv.t() * Ti_inv * Di_inv;
+  return B.t() * B;
 }
 
 inline arma::vec HPC::get_Resid(arma::uword i) const {
-  arma::vec ri;
-  if (i == 0)
-    ri = Resid_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    ri = Resid_.subvec(index, index + m_(i) - 1);
-  }
-  return ri;
+  arma::uword first_index = index_.obs_begin(i);
+  return Resid_.subvec(first_index, first_index + m_(i) - 1);
 }
 
 inline void HPC::get_Phi(arma::uword i, arma::mat& Phii) const {
   Phii = arma::zeros<arma::mat>(m_(i), m_(i));
   if (m_(i) != 1) {
-    if (i == 0) {
-      arma::uword first_index = 0;
-      arma::uword last_index = m_(0) * (m_(0) - 1) / 2 - 1;
-
-      Phii = pan::ltrimat(m_(0), Wgma_.subvec(first_index, last_index), false);
-    } else {
-      arma::uword first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) - 1) / 2;
-      }
-      arma::uword last_index = first_index + m_(i) * (m_(i) - 1) / 2 - 1;
+    arma::uword first_index = index_.pair_begin(i);
+    arma::uword last_index = first_index + index_.n_pairs(i) - 1;
 
-      Phii = pan::ltrimat(m_(i), Wgma_.subvec(first_index, last_index), false);
-    }
+    Phii = pan::ltrimat(m_(i), Wgma_.subvec(first_index, last_index), false);
   }
 }
 
@@ -234,55 +199,17 @@ inline void HPC::get_R(arma::uword i, arma::mat& Ri) const {
 }
 
 inline void HPC::get_D(arma::uword i, arma::mat& Di) const {
-  Di = arma::eye(m_(i), m_(i));
-  if (i == 0)
-    Di = arma::diagmat(arma::exp(Zlmd_.subvec(0, m_(0) - 1) / 2));
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    Di = arma::diagmat(arma::exp(Zlmd_.subvec(index, index + m_(i) - 1) / 2));
-  }
+  arma::uword first_index = index_.obs_begin(i);
+  Di = arma::diagmat(
+      arma::exp(Zlmd_.subvec(first_index, first_index + m_(i) - 1) / 2));
 }
 
 inline void HPC::get_T(arma::uword i, arma::mat& Ti) const {
-  Ti = arma::eye(m_(i), m_(i));
-  if (m_(i) != 1) {
-    if (i == 0) {
-      arma::uword first_index = 0;
-      arma::uword last_index = m_(0) * (m_(0) + 1) / 2 - 1;
-
-      Ti = pan::ltrimat(m_(0), Telem_.subvec(first_index, last_index), true);
-    } else {
-      arma::uword first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) + 1) / 2;
-      }
-      arma::uword last_index = first_index + m_(i) * (m_(i) + 1) / 2 - 1;
-
-      Ti = pan::ltrimat(m_(i), Telem_.subvec(first_index, last_index), true);
-    }
-  }
+  packed_T(i).Unpack(Ti);
 }
 
 inline void HPC::get_invT(arma::uword i, arma::mat& Ti_inv) const {
-  Ti_inv = arma::eye(m_(i), m_(i));
-  if (m_(i) != 1) {
-    if (i == 0) {
-      arma::uword first_index = 0;
-      arma::uword last_index = m_(0) * (m_(0) + 1) / 2 - 1;
-
-      Ti_inv =
-          pan::ltrimat(m_(0), invTelem_.subvec(first_index, last_index), true);
-    } else {
-      arma::uword first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) + 1) / 2;
-      }
-      arma::uword last_index = first_index + m_(i) * (m_(i) + 1) / 2 - 1;
-
-      Ti_inv =
-          pan::ltrimat(m_(i), invTelem_.subvec(first_index, last_index), true);
-    }
-  }
+  packed_invT(i).Unpack(Ti_inv);
 }
 
 inline void HPC::get_Sigma_inv(arma::uword i, arma::mat& Sigmai_inv) const {
@@ -300,44 +227,48 @@ inline void HPC::get_Sigma_inv(arma::uword i, arma::mat& Sigmai_inv) const {
 }
 
 inline void HPC::get_Resid(arma::uword i, arma::vec& ri) const {
-  if (i == 0)
-    ri = Resid_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    ri = Resid_.subvec(index, index + m_(i) - 1);
-  }
+  arma::uword first_index = index_.obs_begin(i);
+  ri = Resid_.subvec(first_index, first_index + m_(i) - 1);
 }
 
 inline double HPC::operator()(const arma::vec& x) {
+  ++eval_counts_.n_value;
   UpdateJmcm(x);
 
-  arma::uword i, n_sub = m_.n_elem;
-  double result = 0.0;
-
-  //#pragma omp parallel for reduction(+:result)
-  for (i = 0; i < n_sub; ++i) {
-    // arma::mat Ti = get_T(i);
-    arma::mat Ti;
-    get_T(i, Ti);
-    // arma::vec ri = get_Resid(i);
-    arma::vec ri;
-    get_Resid(i, ri);
-    // arma::mat Sigmai_inv = get_Sigma_inv(i);
-    arma::mat Sigmai_inv;
-    get_Sigma_inv(i, Sigmai_inv);
-    result += 2 * arma::sum(arma::log(Ti.diag())) +
-              arma::as_scalar(ri.t() * Sigmai_inv * ri);
+  if (scatter_path()) {
+    // sum_i e_i' e_i = tr(B R R' B'), B = T^{-1} D^{-1}
+    double n_sub = m_.n_elem;
+    return arma::trace(WhitenedScatter()) +
+           n_sub * (arma::accu(view_Zlmd(0)) +
+                    2.0 * packed_T(patterns_.rep_of(0)).LogDet());
   }
 
-  result += 2 * arma::sum(arma::log(arma::exp(Zlmd_ / 2)));
+  // with e_i = T_i^{-1} D_i^{-1} r_i kept in TDResid_:
+  // r_i' Sigma_i^{-1} r_i = e_i' e_i, and
+  // log|Sigma_i| = sum_j log D_ijj^2 + 2 sum_j log T_ijj
+  const double* zlmd = Zlmd_.memptr();
+  const double* e = TDResid_.memptr();
+  const double* w = obs_weight_.memptr();
+  const pan::ChunkPlan& chunks = subject_plan_;
+  double result = pan::ParallelSum(
+      chunks, team(), 0.0, [&](arma::uword c, double& part) {
+        arma::uword first = index_.obs_begin(chunks.begin(c)),
+                    last = index_.obs_begin(chunks.end(c));
+        for (arma::uword k = first; k != last; ++k)
+          part += w[k] * (e[k] * e[k] + zlmd[k]);
+      });
+  for (arma::uword p = 0; p != patterns_.n_patterns(); ++p)
+    result += 2.0 * pattern_weight_(p) * packed_T(patterns_.rep_of(p)).LogDet();
+  patterns_.RecordSweep();
 
   return result;
 }
 
 inline void HPC::Gradient(const arma::vec& x, arma::vec& grad) {
+  ++eval_counts_.n_gradient;
   UpdateJmcm(x);
 
-  arma::uword n_bta = X_.n_cols, n_lmd = Z_.n_cols, n_gma = W_.n_cols;
+  arma::uword n_bta = X_.n_cols, n_lmd = Z_.n_cols, n_gma = lags_.n_cols();
 
   arma::vec grad1, grad2, grad3;
 
@@ -367,55 +298,172 @@ inline void HPC::Gradient(const arma::vec& x, arma::vec& grad) {
 }
 
 inline void HPC::Grad1(arma::vec& grad1) {
-  arma::uword i, n_sub = m_.n_elem, n_bta = X_.n_cols;
-  grad1 = arma::zeros<arma::vec>(n_bta);
-
-  for (i = 0; i < n_sub; ++i) {
-    arma::mat Xi = get_X(i);
-    arma::vec ri;
-    get_Resid(i, ri);
-    arma::mat Sigmai_inv;
-    get_Sigma_inv(i, Sigmai_inv);
-    grad1 += Xi.t() * Sigmai_inv * ri;
+  arma::uword n_sub = m_.n_elem;
+
+  // Sigma_i^{-1} r_i = D_i^{-1} T_i^{-T} e_i stacked over subjects, so that
+  // the sum of the X_i' Sigma_i^{-1} r_i is a single product with X
+  arma::vec SigmaResid(Resid_.n_rows);
+  if (balanced_) {
+    arma::mat T_inv;
+    get_invT(0, T_inv);
+
+    arma::mat SR(SigmaResid.memptr(), m_(0), n_sub, false, true);
+    SR = T_inv.t() * MatView(TDResid_, m_(0), n_sub);
+  } else {
+    const pan::ChunkPlan& chunks = subject_plan_;
+    pan::ParallelFor(chunks, team(), [&](arma::uword c) {
+      for (arma::uword i = chunks.begin(c); i != chunks.end(c); ++i) {
+        arma::uword first_index = index_.obs_begin(i);
+        packed_invT(i).MultiplyTrans(TDResid_.memptr() + first_index,
+                                     SigmaResid.memptr() + first_index);
+      }
+    });
   }
+  patterns_.RecordSweep();
+  SigmaResid %= arma::exp(-Zlmd_ / 2);
+  if (weighted_) SigmaResid %= obs_weight_;
 
-  grad1 *= -2;
+  grad1 = -2 * (X_.t() * SigmaResid);
 }
 
-inline void HPC::Grad2(arma::vec& grad2) {
-  arma::uword i, n_sub = m_.n_elem, n_lmd = Z_.n_cols, n_gma = W_.n_cols;
-  grad2 = arma::zeros<arma::vec>(n_lmd + n_gma);
-  arma::vec grad2_lmd = arma::zeros<arma::vec>(n_lmd);
-  arma::vec grad2_gma = arma::zeros<arma::vec>(n_gma);
-
-  for (i = 0; i < n_sub; ++i) {
-    arma::vec one = arma::ones<arma::vec>(m_(i));
-    arma::mat Zi = get_Z(i);
-    arma::vec hi;
-    get_TDResid2(i, hi);
-
-    grad2_lmd += 0.5 * Zi.t() * (hi - one);
-
-    arma::mat Phii;
-    get_Phi(i, Phii);
-    // arma::mat Ti = get_T(i);
-    arma::mat Ti;
-    get_T(i, Ti);
-    // arma::mat Ti_inv = arma::pinv(Ti);
-    // arma::mat Ti_inv = Ti.i();
-    arma::mat Ti_inv;
-    get_invT(i, Ti_inv);
-    // arma::vec ei = get_TDResid(i);
-    arma::vec ei;
-    get_TDResid(i, ei);
-
-    arma::mat Ti_trans_deriv = CalcTransTiDeriv(i, Phii, Ti);
-    for (arma::uword j = 0; j != m_(i); ++j) {
-      grad2_gma += -1 / Ti(j, j) * CalcTijkDeriv(i, j, j, Phii, Ti);
+inline void HPC::Whiten(arma::uword i, double* v) const {
+  const double* zlmd = Zlmd_.memptr() + index_.obs_begin(i);
+
+  for (arma::uword j = 0; j != m_(i); ++j) v[j] *= std::exp(-zlmd[j] / 2);
+  packed_invT(i).Multiply(v, v);
+}
+
+inline void HPC::FactorDerivs(arma::uword i, arma::mat& B, arma::cube& dB,
+                              arma::cube* d2B) const {
+  arma::uword mi = m_(i), n_gma = lags_.n_cols(),
+              first_pair = index_.pair_begin(i);
+  arma::mat Ti, Ti_inv;
+  get_T(i, Ti);
+  get_invT(i, Ti_inv);
+  B = Ti_inv.each_row() % arma::exp(-view_Zlmd(i) / 2).t();
+
+  // log T_jk = sum_{l < k} log sin(phi_jl) + log cos(phi_jk) (no cosine on
+  // the diagonal), so dT_jk / dgamma = T_jk u_jk and d2T_jk / dgamma^2 =
+  // T_jk (u_jk u_jk' + V_jk) with
+  //   u_jk = sum_{l < k} cot(phi_jl) W_ijl - tan(phi_jk) W_ijk,
+  //   V_jk = -sum_{l < k} W_ijl W_ijl' / sin^2(phi_jl)
+  //          - W_ijk W_ijk' / cos^2(phi_jk),
+  // the sums over l < k running along row j; d2T is only needed for d2B
+  arma::cube dT = arma::zeros<arma::cube>(mi, mi, n_gma);
+  arma::cube d2T;
+  if (d2B != nullptr) d2T.zeros(mi, mi, n_gma * (n_gma + 1) / 2);
+  bool second = d2B != nullptr;
+  arma::vec u, w;
+  arma::mat V;
+  for (arma::uword j = 0; j != mi; ++j) {
+    arma::vec U = arma::zeros<arma::vec>(n_gma);
+    arma::mat S = arma::zeros<arma::mat>(n_gma, n_gma);
+    arma::uword row = first_pair + j * (j - 1) / 2;
+    for (arma::uword k = 0; k <= j; ++k) {
+      double phi = 0.0;
+      if (k < j) {
+        w = lags_.row(row + k).t();
+        phi = Wgma_(row + k);
+        u = U - std::tan(phi) * w;
+        if (second) V = S - w * w.t() / std::pow(std::cos(phi), 2);
+      } else {
+        u = U;
+        if (second) V = S;
+      }
+
+      for (arma::uword c = 0; c != n_gma; ++c) {
+        dT(j, k, c) = Ti(j, k) * u(c);
+        if (!second) continue;
+        for (arma::uword d = 0; d <= c; ++d)
+          d2T(j, k, c * (c + 1) / 2 + d) = Ti(j, k) * (u(c) * u(d) + V(c, d));
+      }
+
+      if (k < j) {
+        U += w / std::tan(phi);
+        if (second) S -= w * w.t() / std::pow(std::sin(phi), 2);
+      }
     }
-    grad2_gma += arma::kron(ei.t(), arma::eye(n_gma, n_gma)) * Ti_trans_deriv *
-                 Ti_inv.t() * ei;
   }
+
+  InvFactorDerivs(i, Ti_inv, B, dT, d2T, dB, d2B);
+}
+
+inline void HPC::Grad2(arma::vec& grad2) {
+  arma::uword n_sub = m_.n_elem, n_lmd = Z_.n_cols, n_gma = lags_.n_cols();
+  grad2 = arma::zeros<arma::vec>(n_lmd + n_gma);
+
+  // sum_i 0.5 * Z_i' (h_i - 1), all subjects at once
+  arma::vec u = TDResid2_ - 1.0;
+  if (weighted_) u %= obs_weight_;
+  arma::vec grad2_lmd = 0.5 * (Z_.t() * u);
+
+  // With the angles phi_jk = W_ijk' gamma, T_i has the elements
+  //   T_jk = cos(phi_jk) prod_{l < k} sin(phi_jl),  k < j,
+  //   T_jj = prod_{l < j} sin(phi_jl),
+  // so dT_jk / dgamma = T_jk (-tan(phi_jk) W_ijk + sum_{l < k} cot(phi_jl)
+  // W_ijl). With a_jk = T_jk M_jk, M = T_i^{-T} sum_i w_i e_i e_i' and w_p
+  // the weight of the pattern, the gamma part of a pattern is then
+  //   sum_{j > l} W_ijl (-tan(phi_jl) a_jl + cot(phi_jl) (R_jl - w_p)),
+  // where R_jl = a_j,l+1 + ... + a_jj is summed leftwards from the diagonal
+  // of row j. Once M is known this takes O(m_i^2), and the scalars are
+  // summed per distinct lag before the product with W. M is built from
+  // f_i = T_i^{-T} e_i for a pattern with at most m_i subjects, and from
+  // sum_i w_i e_i e_i' otherwise.
+  const pan::ChunkPlan& chunks = pattern_plan_;
+  arma::vec zero = arma::zeros<arma::vec>(lags_.n_lag());
+  arma::vec c = pan::ParallelSum(
+      chunks, team(), zero, [&](arma::uword ch, arma::vec& part) {
+        arma::vec f;
+        for (arma::uword p = chunks.begin(ch); p != chunks.end(ch); ++p) {
+          arma::uword rep = patterns_.rep_of(p), mi = m_(rep),
+                      first_pair = index_.pair_begin(rep);
+          const pan::PackedLowerTri Ti = packed_T(rep);
+          const pan::PackedLowerTri Ti_inv = packed_invT(rep);
+
+          arma::mat M = arma::zeros<arma::mat>(mi, mi);
+          if (patterns_.size(p) <= mi) {
+            f.set_size(mi);
+            for (arma::uword s = patterns_.begin(p); s != patterns_.end(p);
+                 ++s) {
+              arma::uword i = patterns_.subject(s);
+              const arma::vec ei = view_TDResid(i);
+              Ti_inv.MultiplyTrans(ei.memptr(), f.memptr());
+              M += weight_(i) * (f * ei.t());
+            }
+          } else {
+            if (scatter_path()) {
+              M = WhitenedScatter();  // E E' = B R R' B'
+            } else if (balanced_) {
+              const arma::mat E = MatView(TDResid_, mi, n_sub);
+              M = E * (E.each_row() % weight_.t()).t();
+            } else {
+              for (arma::uword s = patterns_.begin(p); s != patterns_.end(p);
+                   ++s) {
+                arma::uword i = patterns_.subject(s);
+                const arma::vec ei = view_TDResid(i);
+                M += weight_(i) * (ei * ei.t());
+              }
+            }
+            for (arma::uword k = 0; k != mi; ++k)
+              Ti_inv.MultiplyTrans(M.colptr(k), M.colptr(k));
+          }
+
+          double wp = pattern_weight_(p);
+          for (arma::uword j = 1; j < mi; ++j) {
+            arma::uword row = first_pair + j * (j - 1) / 2;
+            const double* phi = Wgma_.memptr() + row;
+            double r = Ti.diag(j) * M(j, j);
+            for (arma::uword l = j; l-- > 0;) {
+              double a = Ti.lower(j, l) * M(j, l);
+              part(lags_.lag_id(row + l)) +=
+                  -std::tan(phi[l]) * a + (r - wp) / std::tan(phi[l]);
+              r += a;
+            }
+          }
+        }
+      });
+  arma::vec grad2_gma = lags_.MultiplyTrans(c);
+  patterns_.RecordSweep();
   grad2.subvec(0, n_lmd - 1) = grad2_lmd;
   grad2.subvec(n_lmd, n_lmd + n_gma - 1) = grad2_gma;
 
@@ -444,6 +492,7 @@ inline void HPC::UpdateJmcm(const arma::vec& x) {
   }
 
   if (update) {
+    ++eval_counts_.n_update;
     UpdateParam(x);
     UpdateModel();
   } else {
@@ -454,7 +503,7 @@ inline void HPC::UpdateJmcm(const arma::vec& x) {
 inline void HPC::UpdateParam(const arma::vec& x) {
   arma::uword n_bta = X_.n_cols;
   arma::uword n_lmd = Z_.n_cols;
-  arma::uword n_gma = W_.n_cols;
+  arma::uword n_gma = lags_.n_cols();
 
   switch (free_param_) {
     case 0:
@@ -491,8 +540,8 @@ inline void HPC::UpdateModel() {
         Xbta_ = X_ * beta_;
 
       Zlmd_ = Z_ * lambda_;
-      Wgma_ = W_ * gamma_;
-      Resid_ = Y_ - Xbta_;
+      lags_.Multiply(gamma_, Wgma_);
+      UpdateResid();
 
       UpdateTelem();
       UpdateTDResid();
@@ -505,14 +554,14 @@ inline void HPC::UpdateModel() {
       else
         Xbta_ = X_ * beta_;
 
-      Resid_ = Y_ - Xbta_;
+      UpdateResid();
       UpdateTDResid();
 
       break;
 
     case 23:
       Zlmd_ = Z_ * lambda_;
-      Wgma_ = W_ * gamma_;
+      lags_.Multiply(gamma_, Wgma_);
 
       UpdateTelem();
       UpdateTDResid();
@@ -525,182 +574,102 @@ inline void HPC::UpdateModel() {
 }
 
 inline arma::vec HPC::get_TDResid(arma::uword i) const {
-  arma::vec TiDiri;
-  if (i == 0)
-    TiDiri = TDResid_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    TiDiri = TDResid_.subvec(index, index + m_(i) - 1);
-  }
-  return TiDiri;
+  return view_TDResid(i);
 }
 
 inline void HPC::get_TDResid(arma::uword i, arma::vec& TiDiri) const {
-  if (i == 0)
-    TiDiri = TDResid_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    TiDiri = TDResid_.subvec(index, index + m_(i) - 1);
-  }
+  TiDiri = view_TDResid(i);
 }
 
 inline arma::vec HPC::get_TDResid2(arma::uword i) const {
-  arma::vec TiDiri2;
-  if (i == 0)
-    TiDiri2 = TDResid2_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    TiDiri2 = TDResid2_.subvec(index, index + m_(i) - 1);
-  }
-  return TiDiri2;
+  return view_TDResid2(i);
 }
 
-inline void HPC::get_TDResid2(arma::uword i, arma::vec& TiDiri2) const {
-  if (i == 0)
-    TiDiri2 = TDResid2_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    TiDiri2 = TDResid2_.subvec(index, index + m_(i) - 1);
-  }
+inline void HPC::get_TDResid2(arma::uword i,
+                                 arma::vec& TiDiri2) const {
+  TiDiri2 = view_TDResid2(i);
 }
 
-inline void HPC::UpdateTelem() {
-  arma::uword i, n_sub = m_.n_elem;
-
-  for (i = 0; i < n_sub; ++i) {
-    // arma::mat Phii = get_Phi(i);
-    arma::mat Phii;
-    get_Phi(i, Phii);
-    arma::mat Ti = arma::eye(m_(i), m_(i));
-
-    Ti(0, 0) = 1;
-    for (arma::uword j = 1; j != m_(i); ++j) {
-      Ti(j, 0) = std::cos(Phii(j, 0));
-      Ti(j, j) = arma::prod(arma::prod(arma::sin(Phii.submat(j, 0, j, j - 1))));
-      for (arma::uword l = 1; l != j; ++l) {
-        Ti(j, l) =
-            std::cos(Phii(j, l)) *
-            arma::prod(arma::prod(arma::sin(Phii.submat(j, 0, j, l - 1))));
-      }
-    }
-
-    // Ti_inv = Ti.i();
-    arma::mat Ti_inv;
-    // bool is_Ti_pd = arma::inv(Ti_inv, Ti);
-    // if (!is_Ti_pd) Ti_inv = arma::pinv(Ti);
-    if (!arma::inv(Ti_inv, Ti)) Ti_inv = arma::pinv(Ti);
-
-    if (i == 0) {
-      arma::uword first_index = 0;
-      arma::uword last_index = m_(0) * (m_(0) + 1) / 2 - 1;
-
-      Telem_.subvec(first_index, last_index) = pan::lvectorise(Ti, true);
-      invTelem_.subvec(first_index, last_index) = pan::lvectorise(Ti_inv, true);
-    } else {
-      arma::uword first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) + 1) / 2;
-      }
-      arma::uword last_index = first_index + m_(i) * (m_(i) + 1) / 2 - 1;
-
-      Telem_.subvec(first_index, last_index) = pan::lvectorise(Ti, true);
-      invTelem_.subvec(first_index, last_index) = pan::lvectorise(Ti_inv, true);
-    }
-  }
+inline const arma::vec HPC::view_TDResid(arma::uword i) const {
+  return ColView(TDResid_, index_.obs_begin(i), m_(i));
 }
 
-inline void HPC::UpdateTDResid() {
-  arma::uword i, n_sub = m_.n_elem;
-
-  for (i = 0; i < n_sub; ++i) {
-    // arma::vec ri = get_Resid(i);
-    arma::vec ri;
-    get_Resid(i, ri);
-
-    // arma::mat Ti = get_T(i);
-    arma::mat Ti;
-    get_T(i, Ti);
-    //  arma::mat Ti_inv = arma::pinv(Ti);
-    //           arma::mat Ti_inv = Ti.i();
-    arma::mat Ti_inv;
-    get_invT(i, Ti_inv);
-
-    // arma::mat Di = get_D(i);
-    arma::mat Di;
-    get_D(i, Di);
-    arma::mat Di_inv = arma::diagmat(arma::pow(Di.diag(), -1));
-
-    arma::vec TiDiri = Ti_inv * Di_inv * ri;
-    arma::vec TiDiri2 = arma::diagvec(Ti_inv.t() * Ti_inv * Di_inv * ri *
-                                      ri.t() * Di_inv);  // hi
-
-    if (i == 0) {
-      TDResid_.subvec(0, m_(0) - 1) = TiDiri;
-      TDResid2_.subvec(0, m_(0) - 1) = TiDiri2;
-    } else {
-      arma::uword index = arma::sum(m_.subvec(0, i - 1));
-      TDResid_.subvec(index, index + m_(i) - 1) = TiDiri;
-      TDResid2_.subvec(index, index + m_(i) - 1) = TiDiri2;
-    }
-  }
+inline const arma::vec HPC::view_TDResid2(arma::uword i) const {
+  return ColView(TDResid2_, index_.obs_begin(i), m_(i));
 }
 
-inline arma::vec HPC::Wijk(arma::uword i, arma::uword j, arma::uword k) {
-  arma::uword n_sub = m_.n_rows;
-  arma::uword n_gma = W_.n_cols;
-
-  arma::uword W_rowindex = 0;
-  bool indexfound = false;
-  arma::vec result = arma::zeros<arma::vec>(n_gma);
-  for (arma::uword ii = 0; ii != n_sub && !indexfound; ++ii) {
-    for (arma::uword jj = 0; jj != m_(ii) && !indexfound; ++jj) {
-      for (arma::uword kk = 0; kk != jj && !indexfound; ++kk) {
-        if (ii == i && jj == j && kk == k) {
-          indexfound = true;
-          result = W_.row(W_rowindex).t();
+inline void HPC::UpdateTelem() {
+  // only for the representative of each covariance pattern (see cov_rep)
+  const pan::ChunkPlan& chunks = pattern_plan_;
+  solver_stats_ += pan::ParallelSum(
+      chunks, team(), pan::SolverStats(),
+      [&](arma::uword c, pan::SolverStats& stats) {
+        for (arma::uword p = chunks.begin(c); p != chunks.end(c); ++p) {
+          arma::uword i = patterns_.rep_of(p), mi = m_(i);
+
+          // T_i from the packed angles Phi_i, row by row:
+          //   T(j, l) = cos(phi_jl) prod_{k < l} sin(phi_jk),  l < j
+          //   T(j, j) = prod_{k < j} sin(phi_jk)
+          const double* phi = Wgma_.memptr() + index_.pair_begin(i);
+          double* t = Telem_.memptr() + index_.tri_begin(i);
+          t[0] = 1.0;
+          for (arma::uword j = 1; j < mi; ++j) {
+            const double* phij = phi + j * (j - 1) / 2;
+            double* tj = t + j * (j + 1) / 2;
+            double sin_prod = 1.0;
+            for (arma::uword l = 0; l != j; ++l) {
+              tj[l] = std::cos(phij[l]) * sin_prod;
+              sin_prod *= std::sin(phij[l]);
+            }
+            tj[j] = sin_prod;
+          }
+
+          // T_jj is a product of sines, so T_i is singular when an angle is
+          // a multiple of pi; that case goes to the (counted) SVD fallback
+          pan::InvertLowerTri(pan::PackedLowerTri(t, mi, true),
+                              invTelem_.memptr() + index_.tri_begin(i),
+                              &stats);
         }
-        ++W_rowindex;
-      }
-    }
-  }
-  return result;
+      });
+  patterns_.RecordSweep();
 }
 
-inline arma::vec HPC::CalcTijkDeriv(arma::uword i, arma::uword j, arma::uword k,
-                                    const arma::mat& Phii,
-                                    const arma::mat& Ti) {
-  arma::uword n_gma = W_.n_cols;
-
-  arma::vec result = arma::zeros<arma::vec>(n_gma);
-  if (k < j) {
-    result = Ti(j, k) * (-std::tan(Phii(j, k)) * Wijk(i, j, k));
-    for (arma::uword l = 0; l != k; ++l) {
-      result += Ti(j, k) * Wijk(i, j, l) / std::tan(Phii(j, l));
-    }
-    return result;
-  } else if (k == j) {
-    for (arma::uword l = 0; l != k; ++l) {
-      result += Ti(j, k) * Wijk(i, j, l) / std::tan(Phii(j, l));
-    }
-    return result;
+inline void HPC::UpdateTDResid() {
+  arma::uword n_sub = m_.n_elem;
+
+  if (balanced_) {
+    arma::mat T_inv;
+    get_invT(0, T_inv);
+
+    // with R = [r_1, ..., r_n]: E = T^{-1} D^{-1} R and
+    // H = (T^{-T} E) % (D^{-1} R), whose columns are e_i and h_i
+    arma::mat DR = MatView(Resid_, m_(0), n_sub).each_col() %
+                   arma::exp(-view_Zlmd(0) / 2);
+
+    arma::mat E(TDResid_.memptr(), m_(0), n_sub, false, true);
+    arma::mat H(TDResid2_.memptr(), m_(0), n_sub, false, true);
+    E = T_inv * DR;
+    H = (T_inv.t() * E) % DR;
+    patterns_.RecordSweep();
+    return;
   }
 
-  return result;
-}
-
-inline arma::mat HPC::CalcTransTiDeriv(arma::uword i, const arma::mat& Phii,
-                                       const arma::mat& Ti) {
-  arma::uword n_gma = W_.n_cols;
-
-  arma::mat result = arma::zeros<arma::mat>(n_gma * m_(i), m_(i));
-  for (arma::uword k = 1; k != m_(i); ++k) {
-    for (arma::uword j = 0; j <= k; ++j) {
-      result.submat(j * n_gma, k, (j * n_gma + n_gma - 1), k) =
-          CalcTijkDeriv(i, k, j, Phii, Ti);
+  const pan::ChunkPlan& chunks = subject_plan_;
+  pan::ParallelFor(chunks, team(), [&](arma::uword c) {
+    for (arma::uword i = chunks.begin(c); i != chunks.end(c); ++i) {
+      pan::PackedLowerTri Ti_inv = packed_invT(i);
+      arma::vec Diri = arma::exp(-view_Zlmd(i) / 2) % view_Resid(i);
+
+      // e_i = T_i^{-1} D_i^{-1} r_i and h_i = (T_i^{-T} e_i) % D_i^{-1} r_i,
+      // the latter built in place in TDResid2_
+      double* ei = TDResid_.memptr() + index_.obs_begin(i);
+      double* hi = TDResid2_.memptr() + index_.obs_begin(i);
+      Ti_inv.Multiply(Diri.memptr(), ei);
+      Ti_inv.MultiplyTrans(ei, hi);
+      for (arma::uword j = 0; j != m_(i); ++j) hi[j] *= Diri(j);
     }
-  }
-
-  return result;
+  });
+  patterns_.RecordSweep();
 }
 
 }  // namespace jmcm
@@ -23,9 +23,15 @@ extern SEXP get_Sigma(SEXP, SEXP, SEXP);
 extern SEXP n2loglik(SEXP, SEXP);
 extern SEXP grad(SEXP, SEXP);
 extern SEXP hess(SEXP, SEXP);
-extern SEXP _jmcm_mcd_estimation(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
-extern SEXP _jmcm_acd_estimation(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
-extern SEXP _jmcm_hpc_estimation(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP get_information(SEXP, SEXP);
+extern SEXP get_patterns(SEXP, SEXP);
+extern SEXP get_load_balance(SEXP, SEXP);
+extern SEXP _jmcm_mcd_estimation(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP _jmcm_acd_estimation(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP _jmcm_hpc_estimation(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP _jmcm_start_values(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP _jmcm_bootstrap_estimation(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
+extern SEXP _jmcm_search_estimation(SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP, SEXP);
 
 static const R_CallMethodDef CallEntries[] = {
     {"MCD__new",             (DL_FUNC) &MCD__new,              5},
@@ -43,9 +49,15 @@ static const R_CallMethodDef CallEntries[] = {
     {"n2loglik",             (DL_FUNC) &n2loglik,              2},
     {"grad",                 (DL_FUNC) &grad,                  2},
     {"hess",                 (DL_FUNC) &hess,                  2},
-    {"_jmcm_mcd_estimation", (DL_FUNC) &_jmcm_mcd_estimation, 12},
-    {"_jmcm_acd_estimation", (DL_FUNC) &_jmcm_acd_estimation, 12},
-    {"_jmcm_hpc_estimation", (DL_FUNC) &_jmcm_hpc_estimation, 12},
+    {"get_information",      (DL_FUNC) &get_information,       2},
+    {"get_patterns",         (DL_FUNC) &get_patterns,          2},
+    {"get_load_balance",     (DL_FUNC) &get_load_balance,      2},
+    {"_jmcm_mcd_estimation", (DL_FUNC) &_jmcm_mcd_estimation, 20},
+    {"_jmcm_acd_estimation", (DL_FUNC) &_jmcm_acd_estimation, 20},
+    {"_jmcm_hpc_estimation", (DL_FUNC) &_jmcm_hpc_estimation, 20},
+    {"_jmcm_start_values", (DL_FUNC) &_jmcm_start_values,  7},
+    {"_jmcm_bootstrap_estimation", (DL_FUNC) &_jmcm_bootstrap_estimation, 14},
+    {"_jmcm_search_estimation", (DL_FUNC) &_jmcm_search_estimation,  9},
     {NULL, NULL, 0}
 };
 
@@ -22,10 +22,57 @@
 #define ARMA_DONT_PRINT_ERRORS
 #include <RcppArmadillo.h>
 
+#include <algorithm>  // std::copy, std::fill, std::max
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "cov_pattern.h"
+#include "lag_table.h"
+#include "parallel.h"
 #include "roptim.h"
+#include "solver.h"
+#include "subject_index.h"
 
 namespace jmcm {
 
+// The data of a model and the structures derived from them. They do not
+// change once the model is built, and are shared by the model and all its
+// evaluation contexts.
+struct JmcmData {
+  JmcmData(const arma::vec& m, const arma::vec& Y, const arma::mat& X,
+           const arma::mat& Z, const arma::mat& W);
+
+  // The data of a submodel of full, with the columns x_cols of X and z_cols
+  // of Z and the first n_gma columns of W. The lags and the covariance
+  // patterns of full are kept: subjects in different patterns of full may
+  // share their covariance in the submodel, but never the other way round,
+  // so they are only a finer grouping than needed.
+  JmcmData(const JmcmData& full, const arma::uvec& x_cols,
+           const arma::uvec& z_cols, arma::uword n_gma);
+
+  arma::vec m, Y;
+  arma::mat X, Z;
+  LagTable lags;  // W, stored per distinct lag
+  SubjectIndex index;
+  CovPattern patterns;
+  bool balanced;
+};
+
+// Evaluations of a model: the values of -2l and the gradients asked for,
+// and the updates, i.e. the passes that refactor Sigma_i for a new x. A
+// value and a gradient at the same x share one update.
+struct EvalCounts {
+  double n_value = 0;
+  double n_gradient = 0;
+  double n_update = 0;
+
+  void Reset() { n_value = n_gradient = n_update = 0; }
+};
+
+class EvalContext;
+
 class JmcmBase : public roptim::Functor {
  public:
   JmcmBase() = delete;
@@ -34,6 +81,14 @@ class JmcmBase : public roptim::Functor {
 
   JmcmBase(const arma::vec& m, const arma::vec& Y, const arma::mat& X,
            const arma::mat& Z, const arma::mat& W, const arma::uword method_id);
+  JmcmBase(std::shared_ptr<const JmcmData> data, const arma::uword method_id);
+
+  // -2l(x) and its gradient computed in ctx, which must have been made from
+  // this model. Only ctx is updated, so different threads can evaluate the
+  // same model at the same time, each in its own context.
+  using roptim::Functor::operator();
+  double operator()(EvalContext& ctx, const arma::vec& x) const;
+  void Gradient(EvalContext& ctx, const arma::vec& x, arma::vec& grad) const;
 
   arma::uword get_method_id() const { return method_id_; }
 
@@ -41,7 +96,7 @@ class JmcmBase : public roptim::Functor {
   arma::vec get_Y() const { return Y_; }
   arma::mat get_X() const { return X_; }
   arma::mat get_Z() const { return Z_; }
-  arma::mat get_W() const { return W_; }
+  arma::mat get_W() const { return lags_.Expand(); }
 
   arma::uword get_m(arma::uword i) const;
   arma::vec get_Y(arma::uword i) const;
@@ -49,6 +104,22 @@ class JmcmBase : public roptim::Functor {
   arma::mat get_Z(arma::uword i) const;
   arma::mat get_W(arma::uword i) const;
 
+  // Zero-copy views of the blocks of subject i. They alias the stacked
+  // storage of the object, so they must not outlive it, and the views of
+  // parameter-dependent quantities are only valid until the next update.
+  const arma::vec view_Y(arma::uword i) const;
+  const arma::subview<double> view_X(arma::uword i) const;
+  const arma::subview<double> view_Z(arma::uword i) const;
+  const arma::vec view_Zlmd(arma::uword i) const;
+  const arma::vec view_Resid(arma::uword i) const;
+
+  const SubjectIndex& get_index() const { return index_; }
+  const CovPattern& get_patterns() const { return patterns_; }
+  bool is_balanced() const { return balanced_; }
+  const LagTable& get_lags() const { return lags_; }
+  const pan::SolverStats& get_solver_stats() const { return solver_stats_; }
+  void ResetSolverStats() const { solver_stats_.Reset(); }
+
   arma::vec get_theta() const { return theta_; }
   arma::vec get_beta() const { return beta_; }
   arma::vec get_lambda() const { return lambda_; }
@@ -62,6 +133,24 @@ class JmcmBase : public roptim::Functor {
   void set_lmdgma(const arma::vec& x);
   void set_free_param(arma::uword n) { free_param_ = n; }
 
+  // Weights of the subjects in -2l(theta), e.g. the number of times each
+  // subject is drawn in a bootstrap resample, so that a resample is fitted
+  // without copying the data. All ones by default.
+  arma::vec get_weights() const { return weight_; }
+  void set_weights(const arma::vec& w);
+
+  // threads used by the loops over subjects (see parallel.h)
+  int get_n_threads() const { return n_threads_; }
+  void set_n_threads(int n) { n_threads_ = std::max(n, 1); }
+
+  // The chunks of the loops over subjects and over covariance patterns,
+  // balanced by an estimate of the cost of each subject (pattern), and the
+  // busy times of the threads in them so far
+  const pan::ChunkPlan& get_subject_plan() const { return subject_plan_; }
+  const pan::ChunkPlan& get_pattern_plan() const { return pattern_plan_; }
+  const pan::LoadStats& get_load_stats() const { return load_stats_; }
+  void ResetLoadStats() const { load_stats_.Reset(); }
+
   // virtual void UpdateBeta() {}
   void UpdateBeta();
   virtual void UpdateLambda(const arma::vec&) {}
@@ -77,6 +166,27 @@ class JmcmBase : public roptim::Functor {
 
   // virtual double operator()(const arma::vec& x) = 0;
   virtual void Gradient(const arma::vec& x, arma::vec& grad) = 0;
+
+  // f = -2l(x) and its gradient after a single update for x
+  void ValueAndGradient(const arma::vec& x, double& f, arma::vec& grad);
+
+  const EvalCounts& get_eval_counts() const { return eval_counts_; }
+  void ResetEvalCounts() { eval_counts_.Reset(); }
+  void set_eval_counts(const EvalCounts& counts) { eval_counts_ = counts; }
+
+  // The observed Hessian of -2l(x) in closed form, in place of the finite
+  // differences of roptim::Functor, and the expected information
+  // E[-d^2 l(x)], for the parameters set free by free_param (see
+  // Curvature).
+  void Hessian(const arma::vec& x, arma::mat& hess) override;
+  void Information(const arma::vec& x, arma::mat& info);
+
+  // Fisher scoring for the covariance parameters x given beta (and, for
+  // MCD, gamma), i.e. for free_param 2 or 23: steps E[H]^{-1} g with the
+  // expected Hessian E[H] of -2l, halved while -2l increases, until the
+  // relative change of x is below tol. Returns the number of steps taken.
+  virtual arma::uword FisherScoring(arma::vec& x, arma::uword max_iter = 50,
+                                    double tol = 1e-8);
   virtual void UpdateJmcm(const arma::vec& x) = 0;
 
   void set_mean(const arma::vec& mean) {
@@ -85,13 +195,108 @@ class JmcmBase : public roptim::Functor {
   }
 
  protected:
-  arma::vec m_, Y_;
-  arma::mat X_, Z_, W_;
+  // non-owning column vector over x(first), ..., x(first + n - 1)
+  static const arma::vec ColView(const arma::vec& x, arma::uword first,
+                                 arma::uword n) {
+    return arma::vec(const_cast<double*>(x.memptr()) + first, n, false, true);
+  }
+
+  // non-owning n_rows x n_cols matrix over the storage of x, for reading;
+  // writable aliases are constructed in place
+  static const arma::mat MatView(const arma::vec& x, arma::uword n_rows,
+                           arma::uword n_cols) {
+    return arma::mat(const_cast<double*>(x.memptr()), n_rows, n_cols, false,
+                     true);
+  }
+
+  // Subjects in the same covariance pattern share D_i, T_i and Sigma_i,
+  // which are computed for (and T_i stored at) the representative cov_rep(i)
+  // only. Balanced designs are the case of a single pattern: the covariance
+  // is factored once per evaluation, the stacked vectors are read as
+  // m x n_sub matrices and the sums over subjects become matrix products.
+  arma::uword cov_rep(arma::uword i) const { return patterns_.rep(i); }
+
+  // Resid_ = Y_ - Xbta_ and, for a balanced design, the scatter matrix
+  // R R' of the residuals read as R = [r_1, ..., r_n]
+  void UpdateResid();
+
+  // Balanced designs without weights read sum_i r_i' Sigma^{-1} r_i and
+  // the sums over subjects in the covariance gradients from R R', in
+  // O(m^3) once the residuals are updated, whatever the number of subjects
+  bool scatter_path() const { return balanced_ && !weighted_; }
+
+  // B R R' B' for the factor B of Whiten, i.e. sum_i (B r_i) (B r_i)'
+  arma::mat WhitenedScatter() const;
+
+  void MakePlans();
+
+  // v <- B_i v in place, for the factor B_i of Sigma_i^{-1} = B_i' B_i given
+  // by D_i and T_i (D_i^{-1/2} T_i for MCD, T_i^{-1} D_i^{-1/2} for ACD and
+  // HPC), in O(m_i^2) and without forming any m_i x m_i matrix
+  virtual void Whiten(arma::uword i, double* v) const = 0;
+
+  // B_i of Whiten as a dense lower triangular matrix, its derivatives
+  // dB.slice(a) with respect to the a-th element of (lambda, gamma) and,
+  // unless d2B is null, its second derivatives d2B->slice(a (a + 1) / 2 +
+  // b), b <= a, at the current theta
+  virtual void FactorDerivs(arma::uword i, arma::mat& B, arma::cube& dB,
+                            arma::cube* d2B) const = 0;
+
+  // dB and d2B (unless null) for B_i = T_i^{-1} D_i^{-1/2} (ACD and HPC),
+  // given T_i^{-1}, B_i, dT.slice(c) = dT_i / dgamma_c and
+  // d2T.slice(c (c + 1) / 2 + d), d <= c, the latter empty when T_i is
+  // linear in gamma or d2B is null
+  void InvFactorDerivs(arma::uword i, const arma::mat& Ti_inv,
+                       const arma::mat& B, const arma::cube& dT,
+                       const arma::cube& d2T, arma::cube& dB,
+                       arma::cube* d2B) const;
+
+  // G.slice(c) strictly lower triangular with G(j, k, c) = W_ijk,c
+  arma::cube PairSlices(arma::uword i) const;
+
+  // the Hessian of -2l at the current theta (expected == false) or its
+  // expectation (expected == true) for all of theta, and its block for the
+  // parameters set free by free_param
+  arma::mat Curvature(bool expected) const;
+  arma::mat FreeBlock(const arma::mat& H) const;
+
+  // x <- x + t step for the first t = 1, 1/2, 1/4, ... at which
+  // n2loglik(x) does not increase, updating f = n2loglik(x). Returns the
+  // relative change of x, or -1 if no t (down to 2^-30) was accepted.
+  template <typename F>
+  static double DampedStep(const F& n2loglik, const arma::vec& step,
+                           arma::vec& x, double& f);
+
+  // a new object of the same model sharing data_, for EvalContext
+  virtual std::unique_ptr<JmcmBase> NewState() const = 0;
+  friend class EvalContext;
+
+  // the threads of the loops, adding their busy times to load_stats_
+  pan::ThreadTeam team() const {
+    return pan::ThreadTeam(n_threads_, &load_stats_);
+  }
+
+  std::shared_ptr<const JmcmData> data_;
+  const arma::vec& m_;
+  const arma::vec& Y_;
+  const arma::mat& X_;
+  const arma::mat& Z_;
+  const LagTable& lags_;
+  const SubjectIndex& index_;
+  const CovPattern& patterns_;
+  const bool balanced_;
   arma::uword method_id_;
 
   arma::vec theta_, beta_, lambda_, gamma_, lmdgma_;
   arma::vec Xbta_, Zlmd_, Wgma_, Resid_;
 
+  // methods used by the solves so far (see solver.h)
+  mutable pan::SolverStats solver_stats_;
+
+  // evaluations so far, counted by operator(), Gradient and UpdateJmcm of
+  // the models
+  EvalCounts eval_counts_;
+
   // free_param_ == 0  ---- beta + lambda + gamma
   // free_param_ == 1  ---- beta
   // free_param_ == 2  ---- lambda
@@ -99,26 +304,93 @@ class JmcmBase : public roptim::Functor {
   // free_param_ == 23 -----lambda + gamma
   arma::uword free_param_;
 
+  int n_threads_;
+  pan::ChunkPlan subject_plan_, pattern_plan_;
+  mutable pan::LoadStats load_stats_;
+
+  // weight_ per subject, repeated over its observations in obs_weight_ and
+  // summed over the subjects of each pattern in pattern_weight_; weighted_
+  // is false while all the weights are one
+  arma::vec weight_, obs_weight_, pattern_weight_;
+  bool weighted_;
+
+  // Z' W Z for the weights of the observations, the expected Hessian of
+  // -2l in lambda for MCD (see MCD::FisherScoring)
+  arma::mat ZWZ_;
+
+  // work space of UpdateBeta for the whitened design and response
+  arma::vec whitened_;
+
+  arma::mat scatter_;  // R R' (see UpdateResid), balanced designs only
+
   bool cov_only_;
   arma::vec mean_;
 };
 
+// The parameter-dependent state of a model: theta, the linear predictors,
+// the residuals and the factors of Sigma_i at the last point evaluated. A
+// context is a second object of the model that shares its data, and starts
+// at the current theta and free_param of the model with one thread.
+class EvalContext {
+ public:
+  explicit EvalContext(const JmcmBase& model);
+
+  JmcmBase& state() { return *state_; }
+  const JmcmBase& state() const { return *state_; }
+
+ private:
+  std::unique_ptr<JmcmBase> state_;
+};
+
+inline JmcmData::JmcmData(const arma::vec& m, const arma::vec& Y,
+                          const arma::mat& X, const arma::mat& Z,
+                          const arma::mat& W)
+    : m(m),
+      Y(Y),
+      X(X),
+      Z(Z),
+      lags(W),
+      index(m),
+      patterns(index, this->Z, lags),
+      balanced(m.n_elem > 1 && patterns.n_patterns() == 1) {}
+
+inline JmcmData::JmcmData(const JmcmData& full, const arma::uvec& x_cols,
+                          const arma::uvec& z_cols, arma::uword n_gma)
+    : m(full.m),
+      Y(full.Y),
+      X(full.X.cols(x_cols)),
+      Z(full.Z.cols(z_cols)),
+      lags(full.lags, n_gma),
+      index(full.index),
+      patterns(full.patterns),
+      balanced(full.balanced) {}
+
 inline JmcmBase::JmcmBase(const arma::vec& m, const arma::vec& Y,
                           const arma::mat& X, const arma::mat& Z,
                           const arma::mat& W, const arma::uword method_id)
-    : m_(m),
-      Y_(Y),
-      X_(X),
-      Z_(Z),
-      W_(W),
+    : JmcmBase(std::make_shared<JmcmData>(m, Y, X, Z, W), method_id) {}
+
+inline JmcmBase::JmcmBase(std::shared_ptr<const JmcmData> data,
+                          const arma::uword method_id)
+    : data_(std::move(data)),
+      m_(data_->m),
+      Y_(data_->Y),
+      X_(data_->X),
+      Z_(data_->Z),
+      lags_(data_->lags),
+      index_(data_->index),
+      patterns_(data_->patterns),
+      balanced_(data_->balanced),
       method_id_(method_id),
       free_param_(0),
+      n_threads_(1),
+      weighted_(false),
       cov_only_(false),
-      mean_(Y) {
+      mean_(data_->Y) {
   arma::uword N = Y_.n_rows;
   arma::uword n_bta = X_.n_cols;
   arma::uword n_lmd = Z_.n_cols;
-  arma::uword n_gma = W_.n_cols;
+  arma::uword n_gma = lags_.n_cols();
 
   theta_ = arma::zeros<arma::vec>(n_bta + n_lmd + n_gma);
   beta_ = arma::zeros<arma::vec>(n_bta);
@@ -128,66 +400,111 @@ inline JmcmBase::JmcmBase(const arma::vec& m, const arma::vec& Y,
 
   Xbta_ = arma::zeros<arma::vec>(N);
   Zlmd_ = arma::zeros<arma::vec>(N);
-  Wgma_ = arma::zeros<arma::vec>(W_.n_rows);
+  Wgma_ = arma::zeros<arma::vec>(lags_.n_pairs());
   Resid_ = arma::zeros<arma::vec>(N);
-}
+  if (balanced_) scatter_ = arma::zeros<arma::mat>(m_(0), m_(0));
 
-inline arma::uword JmcmBase::get_m(arma::uword i) const { return m_(i); }
+  set_weights(arma::ones<arma::vec>(m_.n_elem));
+  MakePlans();
+}
 
-inline arma::vec JmcmBase::get_Y(arma::uword i) const {
-  arma::vec Yi;
-  if (i == 0)
-    Yi = Y_.subvec(0, m_(0) - 1);
-  else {
-    int index = arma::sum(m_.subvec(0, i - 1));
-    Yi = Y_.subvec(index, index + m_(i) - 1);
+inline void JmcmBase::MakePlans() {
+  arma::uword n_sub = m_.n_elem, n_bta = X_.n_cols, n_gma = lags_.n_cols();
+
+  // A subject costs about m_i for its mean and, for its share of the
+  // gradient, m_i^2 / 2 per beta and (with the rows of W_i only read by
+  // MCD within the subject loop) per gamma.
+  double per_pair = n_bta + 2 + (method_id_ == 0 ? n_gma : 0);
+  arma::vec subject_cost(n_sub);
+  for (arma::uword i = 0; i != n_sub; ++i) {
+    double mi = m_(i);
+    subject_cost(i) = mi + mi * mi * per_pair / 2;
+  }
+  subject_plan_ = pan::ChunkPlan(subject_cost);
+
+  // A pattern is factored once, in m_i^3 / 6, the gamma derivatives of
+  // HPC take m_i^3 per gamma, and each subject of the pattern is whitened
+  // and adds to the gamma gradient in m_i^2.
+  arma::uword n_patterns = patterns_.n_patterns();
+  arma::vec pattern_cost(n_patterns);
+  for (arma::uword p = 0; p != n_patterns; ++p) {
+    double mi = m_(patterns_.rep_of(p));
+    pattern_cost(p) = mi * mi * mi / 6 +
+                      (method_id_ == 2 ? n_gma * mi * mi * mi : 0) +
+                      patterns_.size(p) * mi * mi;
   }
-  return Yi;
+  pattern_plan_ = pan::ChunkPlan(pattern_cost);
 }
 
-inline arma::mat JmcmBase::get_X(arma::uword i) const {
-  arma::mat Xi;
-  if (i == 0)
-    Xi = X_.rows(0, m_(0) - 1);
-  else {
-    int index = arma::sum(m_.subvec(0, i - 1));
-    Xi = X_.rows(index, index + m_(i) - 1);
-  }
-  return Xi;
+inline EvalContext::EvalContext(const JmcmBase& model)
+    : state_(model.NewState()) {
+  JmcmBase& state = *state_;
+  state.cov_only_ = model.cov_only_;
+  state.mean_ = model.mean_;
+  state.set_weights(model.weight_);
+
+  // the derived quantities of a new object are not computed yet, so theta
+  // is marked as unknown to force the first update
+  state.theta_.fill(arma::datum::nan);
+  state.set_theta(model.theta_);
+  state.free_param_ = model.free_param_;
 }
 
-inline arma::mat JmcmBase::get_Z(arma::uword i) const {
-  arma::mat Zi;
-  if (i == 0)
-    Zi = Z_.rows(0, m_(0) - 1);
-  else {
-    int index = arma::sum(m_.subvec(0, i - 1));
-    Zi = Z_.rows(index, index + m_(i) - 1);
-  }
-  return Zi;
+inline double JmcmBase::operator()(EvalContext& ctx,
+                                   const arma::vec& x) const {
+  JmcmBase& state = ctx.state();
+  if (state.data_ != data_ || state.method_id_ != method_id_)
+    throw std::invalid_argument("EvalContext made from another model");
+
+  return state(x);
 }
 
+inline void JmcmBase::Gradient(EvalContext& ctx, const arma::vec& x,
+                               arma::vec& grad) const {
+  JmcmBase& state = ctx.state();
+  if (state.data_ != data_ || state.method_id_ != method_id_)
+    throw std::invalid_argument("EvalContext made from another model");
+
+  state.Gradient(x, grad);
+}
+
+inline arma::uword JmcmBase::get_m(arma::uword i) const { return m_(i); }
+
+inline arma::vec JmcmBase::get_Y(arma::uword i) const { return view_Y(i); }
+
+inline arma::mat JmcmBase::get_X(arma::uword i) const { return view_X(i); }
+
+inline arma::mat JmcmBase::get_Z(arma::uword i) const { return view_Z(i); }
+
 inline arma::mat JmcmBase::get_W(arma::uword i) const {
   arma::mat Wi;
-  if (m_(i) != 1) {
-    if (i == 0) {
-      int first_index = 0;
-      int last_index = m_(0) * (m_(0) - 1) / 2 - 1;
-      Wi = W_.rows(first_index, last_index);
-    } else {
-      int first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) - 1) / 2;
-      }
-      int last_index = first_index + m_(i) * (m_(i) - 1) / 2 - 1;
-
-      Wi = W_.rows(first_index, last_index);
-    }
-  }
+  if (m_(i) != 1) Wi = lags_.Expand(index_.pair_begin(i), index_.n_pairs(i));
 
   return Wi;
 }
 
+inline const arma::vec JmcmBase::view_Y(arma::uword i) const {
+  return ColView(Y_, index_.obs_begin(i), m_(i));
+}
+
+inline const arma::subview<double> JmcmBase::view_X(arma::uword i) const {
+  arma::uword first_index = index_.obs_begin(i);
+  return X_.rows(first_index, first_index + m_(i) - 1);
+}
+
+inline const arma::subview<double> JmcmBase::view_Z(arma::uword i) const {
+  arma::uword first_index = index_.obs_begin(i);
+  return Z_.rows(first_index, first_index + m_(i) - 1);
+}
+
+inline const arma::vec JmcmBase::view_Zlmd(arma::uword i) const {
+  return ColView(Zlmd_, index_.obs_begin(i), m_(i));
+}
+
+inline const arma::vec JmcmBase::view_Resid(arma::uword i) const {
+  return ColView(Resid_, index_.obs_begin(i), m_(i));
+}
+
 inline void JmcmBase::set_theta(const arma::vec& x) {
   arma::uword fp2 = free_param_;
   free_param_ = 0;
@@ -223,21 +540,108 @@ inline void JmcmBase::set_lmdgma(const arma::vec& x) {
   free_param_ = fp2;
 }
 
+inline void JmcmBase::set_weights(const arma::vec& w) {
+  arma::uword n_sub = m_.n_elem;
+  if (w.n_elem != n_sub)
+    throw std::invalid_argument("one weight per subject is needed");
+
+  weight_ = w;
+  weighted_ = arma::any(w != 1.0);
+
+  obs_weight_.set_size(Y_.n_rows);
+  for (arma::uword i = 0; i != n_sub; ++i) {
+    double* wi = obs_weight_.memptr() + index_.obs_begin(i);
+    std::fill(wi, wi + m_(i), w(i));
+  }
+
+  pattern_weight_ = arma::zeros<arma::vec>(patterns_.n_patterns());
+  for (arma::uword i = 0; i != n_sub; ++i)
+    pattern_weight_(patterns_.pattern(i)) += w(i);
+
+  // only read by the IRLS of MCD
+  if (method_id_ == 0) ZWZ_ = Z_.t() * (Z_.each_col() % obs_weight_);
+}
+
+inline void JmcmBase::UpdateResid() {
+  Resid_ = Y_ - Xbta_;
+
+  if (balanced_) {
+    const arma::mat R = MatView(Resid_, m_(0), m_.n_elem);
+    scatter_ = R * R.t();
+  }
+}
+
+inline arma::mat JmcmBase::WhitenedScatter() const {
+  // the columns of B are B e_k
+  arma::uword m0 = m_(0);
+  arma::mat B = arma::eye<arma::mat>(m0, m0);
+  for (arma::uword k = 0; k != m0; ++k) Whiten(0, B.colptr(k));
+
+  return B * scatter_ * B.t();
+}
+
 inline void JmcmBase::UpdateBeta() {
-  arma::uword i, n_sub = m_.n_elem, n_bta = X_.n_cols;
+  arma::uword n_sub = m_.n_elem, n_bta = X_.n_cols;
   arma::mat XSX = arma::zeros<arma::mat>(n_bta, n_bta);
   arma::vec XSY = arma::zeros<arma::vec>(n_bta);
 
-  for (i = 0; i < n_sub; ++i) {
-    arma::mat Xi = get_X(i);
-    arma::vec Yi = get_Y(i);
-    arma::mat Sigmai_inv = get_Sigma_inv(i);
-
-    XSX += Xi.t() * Sigmai_inv * Xi;
-    XSY += Xi.t() * Sigmai_inv * Yi;
+  // the whitened design and response live in whitened_, which keeps its
+  // storage from one update to the next
+  whitened_.set_size(Y_.n_rows * (n_bta + 1));
+
+  if (balanced_) {
+    // X read as m x (n_sub * n_bta), column c * n_sub + i being the column c
+    // of X_i, so that Sigma^{-1} X_i for all i is a single product
+    arma::uword m0 = m_(0), N = Y_.n_rows;
+    const arma::mat Xr(const_cast<double*>(X_.memptr()), m0, n_sub * n_bta,
+                       false, true);
+    arma::mat SX(whitened_.memptr(), m0, n_sub * n_bta, false, true);
+    SX = get_Sigma_inv(0) * Xr;
+    arma::mat SXs(SX.memptr(), N, n_bta, false, true);
+    if (weighted_) SXs.each_col() %= obs_weight_;
+
+    XSX = X_.t() * SXs;
+    XSY = SXs.t() * Y_;
+  } else {
+    // X_i' Sigma_i^{-1} X_i = (B_i X_i)' (B_i X_i), with the whitened blocks
+    // [B_i X_i, B_i Y_i] (scaled by the square root of the weight of subject
+    // i) written straight from X and Y into whitened_, where the rows of a
+    // chunk of subjects form a contiguous n_c x (n_bta + 1) matrix, and
+    // [XSX, XSY] summed over the chunks
+    const pan::ChunkPlan& chunks = subject_plan_;
+    arma::mat zero = arma::zeros<arma::mat>(n_bta, n_bta + 1);
+    arma::mat XSXY = pan::ParallelSum(
+        chunks, team(), zero, [&](arma::uword c, arma::mat& part) {
+          arma::uword first = index_.obs_begin(chunks.begin(c)),
+                      n_c = index_.obs_begin(chunks.end(c)) - first;
+          double* block = whitened_.memptr() + first * (n_bta + 1);
+
+          for (arma::uword i = chunks.begin(c); i != chunks.end(c); ++i) {
+            arma::uword first_index = index_.obs_begin(i), mi = m_(i);
+            double sw = weighted_ ? std::sqrt(weight_(i)) : 1.0;
+            for (arma::uword k = 0; k != n_bta + 1; ++k) {
+              const double* src = k == n_bta ? Y_.memptr() + first_index
+                                             : X_.colptr(k) + first_index;
+              double* dst = block + k * n_c + (first_index - first);
+              std::copy(src, src + mi, dst);
+              Whiten(i, dst);
+              if (weighted_)
+                for (arma::uword j = 0; j != mi; ++j) dst[j] *= sw;
+            }
+          }
+
+          const arma::mat BXc(block, n_c, n_bta, false, true);
+          const arma::mat BXYc(block, n_c, n_bta + 1, false, true);
+          part += BXc.t() * BXYc;
+        });
+
+    XSX = XSXY.head_cols(n_bta);
+    XSY = XSXY.col(n_bta);
   }
+  patterns_.RecordSweep();
 
-  arma::vec beta = XSX.i() * XSY;
+  arma::vec beta;
+  pan::SolveSympd(XSX, XSY, beta, &solver_stats_);
 
   arma::uword fp2 = free_param_;
   free_param_ = 1;
@@ -245,6 +649,264 @@ inline void JmcmBase::UpdateBeta() {
   free_param_ = fp2;
 }
 
+inline void JmcmBase::ValueAndGradient(const arma::vec& x, double& f,
+                                       arma::vec& grad) {
+  // the update done by the value is found up to date by the gradient
+  f = (*this)(x);
+  Gradient(x, grad);
+}
+
+inline void JmcmBase::Hessian(const arma::vec& x, arma::mat& hess) {
+  UpdateJmcm(x);
+  hess = FreeBlock(Curvature(false));
+}
+
+inline void JmcmBase::Information(const arma::vec& x, arma::mat& info) {
+  UpdateJmcm(x);
+  info = FreeBlock(Curvature(true)) / 2;
+}
+
+inline arma::mat JmcmBase::FreeBlock(const arma::mat& H) const {
+  arma::uword n_bta = X_.n_cols, n_lmd = Z_.n_cols, n_par = H.n_rows;
+
+  switch (free_param_) {
+    case 1:
+      return H.submat(0, 0, n_bta - 1, n_bta - 1);
+    case 2:
+      return H.submat(n_bta, n_bta, n_bta + n_lmd - 1, n_bta + n_lmd - 1);
+    case 3:
+      return H.submat(n_bta + n_lmd, n_bta + n_lmd, n_par - 1, n_par - 1);
+    case 23:
+      return H.submat(n_bta, n_bta, n_par - 1, n_par - 1);
+    default:
+      return H;
+  }
+}
+
+inline arma::cube JmcmBase::PairSlices(arma::uword i) const {
+  arma::uword mi = m_(i), n_gma = lags_.n_cols(),
+              first_pair = index_.pair_begin(i);
+
+  arma::cube G = arma::zeros<arma::cube>(mi, mi, n_gma);
+  for (arma::uword j = 1; j < mi; ++j) {
+    for (arma::uword k = 0; k < j; ++k) {
+      const arma::subview_row<double> w =
+          lags_.row(first_pair + j * (j - 1) / 2 + k);
+      for (arma::uword c = 0; c != n_gma; ++c) G(j, k, c) = w(c);
+    }
+  }
+
+  return G;
+}
+
+inline void JmcmBase::InvFactorDerivs(arma::uword i, const arma::mat& Ti_inv,
+                                      const arma::mat& B, const arma::cube& dT,
+                                      const arma::cube& d2T, arma::cube& dB,
+                                      arma::cube* d2B) const {
+  arma::uword mi = m_(i), n_lmd = Z_.n_cols, n_gma = dT.n_slices,
+              n_cov = n_lmd + n_gma;
+  const arma::mat Zi = view_Z(i);
+
+  // dB / dlambda_a = -B diag(z_a) / 2 and dB / dgamma_c = -K_c B with
+  // K_c = T^{-1} dT / dgamma_c, so that
+  //   d2B / dgamma_c dgamma_d = (K_c K_d + K_d K_c - T^{-1} d2T_cd) B
+  dB.set_size(mi, mi, n_cov);
+  arma::cube K(mi, mi, n_gma);
+  for (arma::uword a = 0; a != n_lmd; ++a)
+    dB.slice(a) = -0.5 * (B.each_row() % Zi.col(a).t());
+  for (arma::uword c = 0; c != n_gma; ++c) {
+    K.slice(c) = Ti_inv * dT.slice(c);
+    dB.slice(n_lmd + c) = -K.slice(c) * B;
+  }
+  if (d2B == nullptr) return;
+
+  d2B->set_size(mi, mi, n_cov * (n_cov + 1) / 2);
+  for (arma::uword a = 0; a != n_cov; ++a) {
+    for (arma::uword b = 0; b <= a; ++b) {
+      arma::mat& d2 = d2B->slice(a * (a + 1) / 2 + b);
+      if (a < n_lmd) {
+        d2 = 0.25 * (B.each_row() % (Zi.col(a) % Zi.col(b)).t());
+      } else if (b < n_lmd) {
+        d2 = -0.5 * (dB.slice(a).each_row() % Zi.col(b).t());
+      } else {
+        arma::uword c = a - n_lmd, d = b - n_lmd;
+        arma::mat KK = K.slice(c) * K.slice(d) + K.slice(d) * K.slice(c);
+        if (!d2T.is_empty()) KK -= Ti_inv * d2T.slice(c * (c + 1) / 2 + d);
+        d2 = KK * B;
+      }
+    }
+  }
+}
+
+inline arma::mat JmcmBase::Curvature(bool expected) const {
+  arma::uword n_sub = m_.n_elem, n_bta = X_.n_cols, n_lmd = Z_.n_cols,
+              n_gma = lags_.n_cols(), n_cov = n_lmd + n_gma,
+              n_par = n_bta + n_cov, n_patterns = patterns_.n_patterns();
+
+  // With Sigma_i^{-1} = B_i' B_i for a lower triangular B_i,
+  //   -2l_i = -2 sum_j log|B_i,jj| + r_i' B_i' B_i r_i
+  // and, for elements a and b of (lambda, gamma) and R_i = r_i r_i',
+  //   d2(-2l_i) / da db = 2 tr(B_ab R_i B_i') + 2 tr(B_a R_i B_b')
+  //       - 2 sum_j (B_ab,jj / B_i,jj - B_a,jj B_b,jj / B_i,jj^2)
+  // which only depends on the subjects of a covariance pattern through
+  // sum_i w_i R_i. Its expectation has R_i = Sigma_i = B_i^{-1} B_i^{-T},
+  // for which tr(B_ab Sigma_i B_i') = tr(B_ab B_i^{-1}) = sum_j B_ab,jj /
+  // B_i,jj cancels the second derivatives of the log determinant, leaving
+  //   2 tr(B_a Sigma_i B_b') + 2 sum_j B_a,jj B_b,jj / B_i,jj^2
+  // without the second derivatives of B_i. The patterns
+  // are therefore visited first, keeping B_i and its derivatives for the
+  // subjects, which add the blocks of beta
+  //   d2(-2l_i) / dbeta dbeta' = 2 X_i' B_i' B_i X_i
+  //   d2(-2l_i) / dbeta da = -2 X_i' (B_a' B_i + B_i' B_a) r_i
+  // the latter having zero expectation.
+  std::vector<arma::mat> B(n_patterns);
+  std::vector<arma::cube> dB(n_patterns);
+
+  const pan::ChunkPlan& pattern_chunks = pattern_plan_;
+  arma::mat zero = arma::zeros<arma::mat>(n_cov, n_cov);
+  arma::mat H_cov = pan::ParallelSum(
+      pattern_chunks, team(), zero, [&](arma::uword c, arma::mat& part) {
+        arma::cube d2B;
+        for (arma::uword p = pattern_chunks.begin(c);
+             p != pattern_chunks.end(c); ++p) {
+          arma::uword rep = patterns_.rep_of(p), mi = m_(rep);
+          FactorDerivs(rep, B[p], dB[p], expected ? nullptr : &d2B);
+          const arma::mat& Bp = B[p];
+          const arma::cube& dBp = dB[p];
+          double wp = pattern_weight_(p);
+          const arma::vec b_diag = Bp.diag();
+
+          if (expected) {
+            arma::mat B_inv = arma::inv(arma::trimatl(Bp));
+            const arma::mat Sigma = wp * (B_inv * B_inv.t());
+            const arma::vec b_sq = arma::square(b_diag);
+            for (arma::uword a = 0; a != n_cov; ++a) {
+              const arma::mat BaS = dBp.slice(a) * Sigma;
+              const arma::vec ba_diag = dBp.slice(a).diag() / b_sq;
+              for (arma::uword b = 0; b <= a; ++b)
+                part(a, b) += 2 * arma::accu(BaS % dBp.slice(b)) +
+                              2 * wp * arma::dot(ba_diag, dBp.slice(b).diag());
+            }
+            continue;
+          }
+
+          arma::mat R;
+          if (balanced_) {
+            const arma::mat E = MatView(Resid_, mi, n_sub);
+            if (weighted_)
+              R = E * (E.each_row() % weight_.t()).t();
+            else
+              R = E * E.t();
+          } else {
+            R = arma::zeros<arma::mat>(mi, mi);
+            for (arma::uword s = patterns_.begin(p); s != patterns_.end(p);
+                 ++s) {
+              arma::uword i = patterns_.subject(s);
+              const arma::vec ri = view_Resid(i);
+              R += weight_(i) * (ri * ri.t());
+            }
+          }
+
+          const arma::mat BR = Bp * R;
+          for (arma::uword a = 0; a != n_cov; ++a) {
+            const arma::mat BaR = dBp.slice(a) * R;
+            const arma::vec ba_diag = dBp.slice(a).diag();
+            for (arma::uword b = 0; b <= a; ++b) {
+              const arma::mat& d2 = d2B.slice(a * (a + 1) / 2 + b);
+              const arma::vec bb_diag = dBp.slice(b).diag();
+              double log_det =
+                  arma::accu(d2.diag() / b_diag -
+                             ba_diag % bb_diag / arma::square(b_diag));
+              part(a, b) += 2 * arma::accu(d2 % BR) +
+                            2 * arma::accu(BaR % dBp.slice(b)) -
+                            2 * wp * log_det;
+            }
+          }
+        }
+      });
+  H_cov = arma::symmatl(H_cov);
+
+  // the blocks of beta are left at zero when only those of the covariance
+  // parameters are asked for
+  const pan::ChunkPlan& chunks = subject_plan_;
+  bool with_beta = free_param_ == 0 || free_param_ == 1;
+  zero = arma::zeros<arma::mat>(n_bta, n_par);
+  arma::mat H_bta = zero;
+  if (with_beta) {
+    H_bta = pan::ParallelSum(
+        chunks, team(), zero, [&](arma::uword c, arma::mat& part) {
+          for (arma::uword i = chunks.begin(c); i != chunks.end(c); ++i) {
+            arma::uword p = patterns_.pattern(i);
+            const arma::mat Xi = view_X(i);
+            const arma::mat BX = B[p] * Xi;
+            part.head_cols(n_bta) += 2 * weight_(i) * (BX.t() * BX);
+            if (expected) continue;
+
+            const arma::vec ri = view_Resid(i);
+            const arma::vec Br = B[p] * ri;
+            for (arma::uword a = 0; a != n_cov; ++a) {
+              const arma::mat& Ba = dB[p].slice(a);
+              arma::vec v = Ba.t() * Br + B[p].t() * (Ba * ri);
+              part.col(n_bta + a) -= 2 * weight_(i) * (Xi.t() * v);
+            }
+          }
+        });
+  }
+  patterns_.RecordSweep();
+
+  arma::mat H(n_par, n_par);
+  H.head_rows(n_bta) = H_bta;
+  H.submat(n_bta, 0, n_par - 1, n_bta - 1) = H_bta.tail_cols(n_cov).t();
+  H.submat(n_bta, n_bta, n_par - 1, n_par - 1) = H_cov;
+
+  return H;
+}
+
+inline arma::uword JmcmBase::FisherScoring(arma::vec& x, arma::uword max_iter,
+                                           double tol) {
+  auto n2loglik = [this](const arma::vec& y) { return (*this)(y); };
+  double f = n2loglik(x);
+
+  arma::vec grad, step;
+  arma::mat info;
+  arma::uword iter = 0;
+  while (iter != max_iter) {
+    // E[H] = 2 I for the information I of l
+    Gradient(x, grad);
+    Information(x, info);
+    pan::SolveSympd(2 * info, -grad, step, &solver_stats_);
+
+    double change = DampedStep(n2loglik, step, x, f);
+    if (change < 0) break;
+    ++iter;
+    if (change < tol) break;
+  }
+  UpdateJmcm(x);
+
+  return iter;
+}
+
+template <typename F>
+double JmcmBase::DampedStep(const F& n2loglik, const arma::vec& step,
+                            arma::vec& x, double& f) {
+  const int kMaxHalvings = 30;
+
+  double t = 1.0;
+  for (int h = 0; h != kMaxHalvings; ++h, t /= 2) {
+    arma::vec x_new = x + t * step;
+    double f_new = n2loglik(x_new);
+    if (f_new <= f) {
+      arma::vec scale = arma::clamp(arma::abs(x), 1.0, arma::datum::inf);
+      double change = arma::max(arma::abs(x_new - x) / scale);
+      x = x_new;
+      f = f_new;
+      return change;
+    }
+  }
+
+  return -1;
+}
+
 }  // namespace jmcm
 
 #endif
@@ -23,8 +23,18 @@
 #define ARMA_DONT_PRINT_ERRORS
 #include <RcppArmadillo.h>
 
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
 #include "bfgs.h"
+#include "checkpoint.h"
+#include "jmcm_base.h"
+#include "lbfgs.h"
+#include "optim_stats.h"
 #include "roptim.h"
+#include "trust_region.h"
 
 template <typename JMCM>
 class JmcmFit {
@@ -37,7 +47,7 @@ class JmcmFit {
           const arma::mat& Z, const arma::mat& W, arma::vec start,
           arma::vec mean, bool trace = false, bool profile = true,
           bool errormsg = false, bool covonly = false,
-          std::string optim_method = "default")
+          std::string optim_method = "default", int n_threads = 1)
       : jmcm_(m, Y, X, Z, W),
         start_(start),
         mean_(mean),
@@ -45,15 +55,97 @@ class JmcmFit {
         profile_(profile),
         errormsg_(errormsg),
         covonly_(covonly),
-        optim_method_(optim_method) {
+        optim_method_(optim_method),
+        lbfgs_history_(6),
+        line_search_("backtracking"),
+        checkpoint_every_(0),
+        warm_start_(true),
+        trust_hessian_("exact") {
+    method_id_ = jmcm_.get_method_id();
+    jmcm_.set_n_threads(n_threads);
+    f_min_ = 0.0;
+    n_iters_ = 0;
+    stop_reason_ = pan::StopReason::kNone;
+    n_backtracks_ = 0;
+  }
+
+  // fit to data shared with other fits, e.g. the replicates of a bootstrap
+  JmcmFit(std::shared_ptr<const jmcm::JmcmData> data, arma::vec start,
+          bool trace = false, bool profile = true, bool errormsg = false,
+          std::string optim_method = "default", int n_threads = 1)
+      : jmcm_(std::move(data)),
+        start_(start),
+        trace_(trace),
+        profile_(profile),
+        errormsg_(errormsg),
+        covonly_(false),
+        optim_method_(optim_method),
+        lbfgs_history_(6),
+        line_search_("backtracking"),
+        checkpoint_every_(0),
+        warm_start_(true),
+        trust_hessian_("exact") {
     method_id_ = jmcm_.get_method_id();
+    jmcm_.set_n_threads(n_threads);
     f_min_ = 0.0;
     n_iters_ = 0;
+    stop_reason_ = pan::StopReason::kNone;
+    n_backtracks_ = 0;
   }
 
+  // weights of the subjects (see JmcmBase::set_weights)
+  void set_weights(const arma::vec& w) { jmcm_.set_weights(w); }
+
+  // number of pairs kept by optim_method "lbfgs" (see pan::LBFGS)
+  void set_lbfgs_history(int history) { lbfgs_history_ = history; }
+  // line search of the BFGS and L-BFGS iterations, "backtracking" or
+  // "wolfe" (see pan::LineSearch)
+  void set_line_search(const std::string& name) { line_search_ = name; }
+
+  // Saves the state of the profile loop, or of BFGS over all the
+  // parameters, to file at the start of every every'th iteration, and
+  // continues the next Optimize from the state saved in resume (if not
+  // empty), repeating the iterates of the interrupted fit. Other methods
+  // are not checkpointed.
+  void set_checkpoint(const std::string& file, int every) {
+    checkpoint_file_ = file;
+    checkpoint_every_ = file.empty() ? 0 : every;
+  }
+  void set_resume(const std::string& file) { resume_file_ = file; }
+
+  // Whether BFGS (the fallback of Fisher scoring) and L-BFGS keep their
+  // curvature from one outer iteration of the profile fit to the next, in
+  // place of starting every update of the covariance parameters from a
+  // unit inverse Hessian
+  void set_warm_start(bool warm_start) { warm_start_ = warm_start; }
+
+  // model Hessian of optim_method "trust", "exact" or "bfgs" (see
+  // pan::TrustRegion)
+  void set_trust_hessian(const std::string& name) { trust_hessian_ = name; }
+
   arma::vec Optimize();
   double get_f_min() const { return f_min_; }
   arma::uword get_n_iters() const { return n_iters_; }
+  // evaluations of -2l by the last Optimize (see jmcm::EvalCounts)
+  const jmcm::EvalCounts& get_eval_counts() const {
+    return jmcm_.get_eval_counts();
+  }
+  // iterations of the covariance updates in the outer iterations of the
+  // last profile fit (Fisher scoring, or BFGS if it fell back to it, or
+  // L-BFGS or the trust region; none counted for the methods of optim)
+  arma::uvec get_inner_iters() const {
+    return arma::conv_to<arma::uvec>::from(inner_iters_);
+  }
+  // inner iterations saved against the first, cold, outer iteration: the
+  // sum over the later ones of the iterations they took fewer than it
+  arma::uword get_inner_saved() const;
+  // why the last Optimize stopped, the line search steps it backtracked
+  // (or trust region steps it rejected), the wall time of its phases, and
+  // the norms of the gradient of -2l at its result in beta, lambda and gamma
+  pan::StopReason get_stop_reason() const { return stop_reason_; }
+  double get_n_backtracks() const { return n_backtracks_; }
+  const pan::PhaseTimes& get_times() const { return times_; }
+  const arma::vec& get_grad_norm() const { return grad_norm_; }
 
  private:
   JMCM jmcm_;
@@ -61,16 +153,72 @@ class JmcmFit {
   arma::vec start_, mean_;
   bool trace_, profile_, errormsg_, covonly_;
   std::string optim_method_;
+  int lbfgs_history_;
+  std::string line_search_;
+  std::string checkpoint_file_, resume_file_;
+  int checkpoint_every_;
+  bool warm_start_;
+  std::string trust_hessian_;
 
   double f_min_;
   arma::uword n_iters_;
+  std::vector<arma::uword> inner_iters_;
+  pan::StopReason stop_reason_;
+  double n_backtracks_;
+  pan::PhaseTimes times_;
+  arma::vec grad_norm_;
+
+  void SaveState(pan::Checkpoint state, double n_backtracks) const;
+  pan::Checkpoint LoadState(arma::uword phase);
 };
 
+template <typename JMCM>
+void JmcmFit<JMCM>::SaveState(pan::Checkpoint state,
+                              double n_backtracks) const {
+  const jmcm::EvalCounts& counts = jmcm_.get_eval_counts();
+  state.model = method_id_;
+  state.counts = {counts.n_value, counts.n_gradient, counts.n_update,
+                  n_backtracks_ + n_backtracks};
+  state.inner = arma::conv_to<arma::vec>::from(inner_iters_);
+  pan::SaveCheckpoint(checkpoint_file_, state);
+}
+
+// the state saved in resume_file_, checked against this fit, with the
+// evaluation counters, backtracks and inner iterations restored
+template <typename JMCM>
+pan::Checkpoint JmcmFit<JMCM>::LoadState(arma::uword phase) {
+  pan::Checkpoint state = pan::LoadCheckpoint(resume_file_);
+  if (state.phase != phase || state.model != method_id_ ||
+      state.x.n_elem != start_.n_elem || state.counts.n_elem != 4)
+    throw std::invalid_argument(resume_file_ +
+                                " is the checkpoint of another fit");
+
+  jmcm::EvalCounts counts;
+  counts.n_value = state.counts(0);
+  counts.n_gradient = state.counts(1);
+  counts.n_update = state.counts(2);
+  jmcm_.set_eval_counts(counts);
+  n_backtracks_ = state.counts(3);
+  inner_iters_ = arma::conv_to<std::vector<arma::uword>>::from(state.inner);
+
+  return state;
+}
+
+template <typename JMCM>
+arma::uword JmcmFit<JMCM>::get_inner_saved() const {
+  arma::uword saved = 0;
+  for (std::size_t k = 1; k < inner_iters_.size(); ++k)
+    if (inner_iters_[k] < inner_iters_[0])
+      saved += inner_iters_[0] - inner_iters_[k];
+
+  return saved;
+}
+
 template <typename JMCM>
 arma::vec JmcmFit<JMCM>::Optimize() {
   int n_bta = jmcm_.get_X().n_cols;
   int n_lmd = jmcm_.get_Z().n_cols;
-  int n_gma = jmcm_.get_W().n_cols;
+  int n_gma = jmcm_.get_lags().n_cols();
 
   if (covonly_) {
     if ((jmcm_.get_Y().n_rows != mean_.n_rows) && errormsg_)
@@ -81,8 +229,14 @@ arma::vec JmcmFit<JMCM>::Optimize() {
   }
 
   pan::BFGS<JMCM> bfgs;
+  pan::LBFGS<JMCM> lbfgs;
+  pan::TrustRegion<JMCM> trust;
   pan::LineSearch<JMCM> linesearch;
   linesearch.set_message(errormsg_);
+  lbfgs.set_history(lbfgs_history_);
+  bfgs.set_wolfe(line_search_ == "wolfe");
+  lbfgs.set_wolfe(line_search_ == "wolfe");
+  trust.set_exact_hessian(trust_hessian_ == "exact");
 
   roptim::Roptim<JMCM> optim;
 
@@ -92,11 +246,29 @@ arma::vec JmcmFit<JMCM>::Optimize() {
     optim.set_method(optim_method_);
   }
 
+  if (checkpoint_every_ > 0 || !resume_file_.empty())
+    if (!profile_ && optim_method_ != "default")
+      throw std::invalid_argument(
+          "checkpoints are kept by the profile fit and by BFGS only");
+
   arma::vec x = start_;
+  jmcm_.ResetSolverStats();
+  jmcm_.ResetEvalCounts();
+  inner_iters_.clear();
+  n_backtracks_ = 0;
+  times_.Reset();
+  stop_reason_ = pan::StopReason::kNone;
+  pan::ScopedTimer total_timer(times_.total);
 
   if (profile_) {
+    bfgs.set_warm_start(warm_start_);
+    lbfgs.set_warm_start(warm_start_);
     bfgs.set_trace(trace_);
     bfgs.set_message(errormsg_);
+    lbfgs.set_trace(trace_);
+    lbfgs.set_message(errormsg_);
+    trust.set_trace(trace_);
+    trust.set_message(errormsg_);
 
     optim.control.trace = trace_;
 
@@ -116,35 +288,75 @@ arma::vec JmcmFit<JMCM>::Optimize() {
 
     const int n_pars = x.n_rows;  // number of parameters
 
-    double f = jmcm_(x);
-    arma::vec grad;
-    jmcm_.Gradient(x, grad);
+    double f;
+    arma::vec grad, p;
+    double step_max;
+    int first_iter = 0;
+
+    if (!resume_file_.empty()) {
+      // Continue from the checkpoint
+      pan::Checkpoint state = LoadState(0);
+      x = state.x;
+      f = state.f;
+      grad = state.grad;
+      p = state.p;
+      step_max = state.stepmax;
+      first_iter = state.iter;
+      if (warm_start_ && optim_method_ == "lbfgs")
+        lbfgs.set_curvature(state.hess_inv);
+      else if (warm_start_)
+        bfgs.set_curvature(state.hess_inv);
+    } else {
+      jmcm_.ValueAndGradient(x, f, grad);
 
-    // Initialize the inverse Hessian to a unit matrix
-    arma::mat hess_inv = arma::eye<arma::mat>(n_pars, n_pars);
+      // Initialize the inverse Hessian to a unit matrix
+      arma::mat hess_inv = arma::eye<arma::mat>(n_pars, n_pars);
 
-    // Initialize Newton Step
-    arma::vec p = -hess_inv * grad;
+      // Initialize Newton Step
+      p = -hess_inv * grad;
 
-    // Calculate the maximum step length
-    double sum = sqrt(arma::dot(x, x));
-    const double kStepMax = kScaStepMax * std::max(sum, double(n_pars));
+      // Calculate the maximum step length
+      double sum = sqrt(arma::dot(x, x));
+      step_max = kScaStepMax * std::max(sum, double(n_pars));
+    }
 
     // Main loop over the iterations
-    for (int iter = 0; iter != kIterMax; ++iter) {
+    stop_reason_ = pan::StopReason::kMaxIter;
+    for (int iter = first_iter; iter != kIterMax; ++iter) {
       n_iters_ = iter;
 
+      if (checkpoint_every_ > 0 && iter != first_iter &&
+          iter % checkpoint_every_ == 0) {
+        pan::Checkpoint state;
+        state.phase = 0;
+        state.iter = iter;
+        state.f = f;
+        state.stepmax = step_max;
+        state.x = x;
+        state.grad = grad;
+        state.p = p;
+        if (warm_start_)
+          state.hess_inv = optim_method_ == "lbfgs" ? lbfgs.curvature()
+                                                    : bfgs.curvature();
+        SaveState(state, linesearch.n_backtracks() + bfgs.n_backtracks() +
+                             lbfgs.n_backtracks() + trust.n_rejected());
+      }
+
       arma::vec x2 = x;  // Save the old point
 
-      linesearch.GetStep(jmcm_, x, p, kStepMax);
+      // Update the point and the function value. f and grad are still
+      // those of x, as the profile steps below only move the model to xnew.
+      {
+        pan::ScopedTimer timer(times_.line_search);
+        f = linesearch.GetStep(jmcm_, x, p, step_max, f, grad);
+      }
 
-      f = jmcm_(x);  // Update function value
-      p = x - x2;    // Update line direction
+      p = x - x2;  // Update line direction
       x2 = x;
       f_min_ = f;
 
       if (trace_) {
-        Rcpp::Rcout << std::setw(5) << iter << ": " << std::setw(10) << jmcm_(x)
+        Rcpp::Rcout << std::setw(5) << iter << ": " << std::setw(10) << f
                     << ": ";
         x.t().print();
       }
@@ -157,6 +369,7 @@ arma::vec JmcmFit<JMCM>::Optimize() {
       }
 
       if (test < kTolX) {
+        stop_reason_ = pan::StopReason::kTolX;
         break;
       }
 
@@ -172,11 +385,16 @@ arma::vec JmcmFit<JMCM>::Optimize() {
       }
 
       if (test < grad_tol) {
+        stop_reason_ = pan::StopReason::kGradTol;
         break;
       }
 
-      if (!covonly_) jmcm_.UpdateBeta();
+      if (!covonly_) {
+        pan::ScopedTimer timer(times_.beta);
+        jmcm_.UpdateBeta();
+      }
 
+      pan::ScopedTimer timer(times_.covariance);
       if (method_id_ == 0) {
         arma::vec lmd = x.rows(n_bta, n_bta + n_lmd - 1);
 
@@ -186,12 +404,27 @@ arma::vec JmcmFit<JMCM>::Optimize() {
                       << std::endl;
         }
 
+        // Fisher scoring, i.e. IRLS for the gamma GLM of the squared
+        // innovations, falling back to BFGS if it cannot make a step
         jmcm_.set_free_param(2);
-        if (optim_method_ == "default")
-          bfgs.Optimize(jmcm_, lmd);
-        else
+        arma::uword n_inner = 0;
+        if (optim_method_ == "default") {
+          n_inner = jmcm_.FisherScoring(lmd);
+          if (n_inner == 0) {
+            bfgs.Optimize(jmcm_, lmd);
+            n_inner = bfgs.n_iters() + 1;
+          }
+        } else if (optim_method_ == "lbfgs") {
+          lbfgs.Optimize(jmcm_, lmd);
+          n_inner = lbfgs.n_iters() + 1;
+        } else if (optim_method_ == "trust") {
+          trust.Optimize(jmcm_, lmd);
+          n_inner = trust.n_iters() + 1;
+        } else {
           optim.minimize(jmcm_, lmd);
+        }
         jmcm_.set_free_param(0);
+        inner_iters_.push_back(n_inner);
 
         if (trace_) {
           Rcpp::Rcout << "--------------------------------------------------"
@@ -223,12 +456,28 @@ arma::vec JmcmFit<JMCM>::Optimize() {
             default: {}
           }
         }
+        // Fisher scoring with the expected information of (lambda, gamma),
+        // falling back to BFGS if it cannot make a step; L-BFGS does without
+        // the dense information of a wide design
         jmcm_.set_free_param(23);
-        if (optim_method_ == "default")
-          bfgs.Optimize(jmcm_, lmdgma);
-        else
+        arma::uword n_inner = 0;
+        if (optim_method_ == "default") {
+          n_inner = jmcm_.FisherScoring(lmdgma);
+          if (n_inner == 0) {
+            bfgs.Optimize(jmcm_, lmdgma);
+            n_inner = bfgs.n_iters() + 1;
+          }
+        } else if (optim_method_ == "lbfgs") {
+          lbfgs.Optimize(jmcm_, lmdgma);
+          n_inner = lbfgs.n_iters() + 1;
+        } else if (optim_method_ == "trust") {
+          trust.Optimize(jmcm_, lmdgma);
+          n_inner = trust.n_iters() + 1;
+        } else {
           optim.minimize(jmcm_, lmdgma);
+        }
         jmcm_.set_free_param(0);
+        inner_iters_.push_back(n_inner);
         if (trace_) {
           Rcpp::Rcout << "--------------------------------------------------"
                       << std::endl;
@@ -241,13 +490,40 @@ arma::vec JmcmFit<JMCM>::Optimize() {
 
       p = xnew - x;
     }
+
+    if (trace_) {
+      Rcpp::Rcout << "Inner iterations: " << arma::accu(get_inner_iters())
+                  << ", " << get_inner_saved()
+                  << " fewer than at the first outer iteration" << std::endl;
+    }
   } else {
     if (optim_method_ == "default") {
       bfgs.set_trace(trace_);
       bfgs.set_message(errormsg_);
+      if (checkpoint_every_ > 0)
+        bfgs.set_checkpoint(checkpoint_every_,
+                            [this, &bfgs](const pan::Checkpoint& state) {
+                              SaveState(state, bfgs.n_backtracks());
+                            });
+      if (!resume_file_.empty()) bfgs.set_resume(LoadState(1));
       bfgs.Optimize(jmcm_, x);
       f_min_ = bfgs.f_min();
       n_iters_ = bfgs.n_iters();
+      stop_reason_ = bfgs.stop_reason();
+    } else if (optim_method_ == "lbfgs") {
+      lbfgs.set_trace(trace_);
+      lbfgs.set_message(errormsg_);
+      lbfgs.Optimize(jmcm_, x);
+      f_min_ = lbfgs.f_min();
+      n_iters_ = lbfgs.n_iters();
+      stop_reason_ = lbfgs.stop_reason();
+    } else if (optim_method_ == "trust") {
+      trust.set_trace(trace_);
+      trust.set_message(errormsg_);
+      trust.Optimize(jmcm_, x);
+      f_min_ = trust.f_min();
+      n_iters_ = trust.n_iters();
+      stop_reason_ = trust.stop_reason();
     } else {
       optim.control.trace = trace_;
       optim.minimize(jmcm_, x);
@@ -255,6 +531,27 @@ arma::vec JmcmFit<JMCM>::Optimize() {
     }
   }
 
+  // the rejected steps of the trust region count as its backtracks; a
+  // resumed fit adds them to those before its checkpoint
+  n_backtracks_ += linesearch.n_backtracks() + bfgs.n_backtracks() +
+                   lbfgs.n_backtracks() + trust.n_rejected();
+
+  // The gradient at the result, which is not counted as an evaluation of
+  // the fit
+  jmcm::EvalCounts counts = jmcm_.get_eval_counts();
+  arma::vec grad_x;
+  jmcm_.Gradient(x, grad_x);
+  jmcm_.set_eval_counts(counts);
+  grad_norm_ = {arma::norm(grad_x.head(n_bta)),
+                arma::norm(grad_x.subvec(n_bta, n_bta + n_lmd - 1)),
+                arma::norm(grad_x.tail(n_gma))};
+
+  const pan::SolverStats& stats = jmcm_.get_solver_stats();
+  if (stats.n_svd > 0 && errormsg_)
+    Rcpp::Rcerr << "Singular system in " << stats.n_svd << " of "
+                << stats.n_chol + stats.n_tri + stats.n_svd
+                << " solves, SVD used instead" << std::endl;
+
   return x;
 }
 
@@ -0,0 +1,142 @@
+//  lag_table.h: compressed storage of the design matrix W of the joint
+//               mean-covariance models (MCD/ACD/HPC)
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_SRC_LAG_TABLE_H_
+#define JMCM_SRC_LAG_TABLE_H_
+
+#define ARMA_DONT_PRINT_ERRORS
+#include <RcppArmadillo.h>
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+namespace jmcm {
+
+// W has one row per within-subject pair (j, k), j > k, and that row is a
+// polynomial in the lag t_ij - t_ik. On a measurement grid there are only
+// a few distinct lags, so W is stored as
+//   table_  -- the distinct rows of W (n_lag x n_gma)
+//   lag_id_ -- for every pair, the row of table_ it is equal to
+// and products with W are computed per distinct lag instead of per pair.
+class LagTable {
+ public:
+  LagTable() = default;
+  explicit LagTable(const arma::mat& W);
+
+  // the first n_cols columns of the W of full, with the lags of full (rows
+  // distinct in full may then be equal, which only repeats some work)
+  LagTable(const LagTable& full, arma::uword n_cols)
+      : table_(full.table_.head_cols(n_cols)), lag_id_(full.lag_id_) {}
+
+  arma::uword n_pairs() const { return lag_id_.n_elem; }
+  arma::uword n_lag() const { return table_.n_rows; }
+  arma::uword n_cols() const { return table_.n_cols; }
+
+  const arma::mat& table() const { return table_; }
+  const arma::Col<arma::u32>& lag_id() const { return lag_id_; }
+  arma::uword lag_id(arma::uword p) const { return lag_id_(p); }
+
+  // row of W for pair p
+  const arma::subview_row<double> row(arma::uword p) const {
+    return table_.row(lag_id_(p));
+  }
+
+  // Wgma = W * gamma: table_ * gamma over the distinct lags, then gathered
+  void Multiply(const arma::vec& gamma, arma::vec& Wgma) const;
+
+  // W' * c given the coefficients c summed per distinct lag (n_lag entries)
+  arma::vec MultiplyTrans(const arma::vec& c) const { return table_.t() * c; }
+
+  // rows first, ..., first + n - 1 of W as a dense matrix
+  arma::mat Expand(arma::uword first, arma::uword n) const;
+  arma::mat Expand() const { return Expand(0, n_pairs()); }
+
+ private:
+  arma::mat table_;
+  arma::Col<arma::u32> lag_id_;
+};
+
+inline LagTable::LagTable(const arma::mat& W) : lag_id_(W.n_rows) {
+  arma::uword n_pairs = W.n_rows, n_gma = W.n_cols;
+  if (n_gma == 0) {
+    lag_id_.zeros();
+    return;
+  }
+
+  // rows are compared bitwise, which is exact for the rows built by
+  // ldFormula since equal lags give identical polynomial values
+  std::vector<double> rows;  // distinct rows, row-major
+  std::unordered_multimap<std::size_t, arma::u32> seen;
+  std::vector<double> w(n_gma);
+
+  for (arma::uword p = 0; p != n_pairs; ++p) {
+    std::size_t h = 0;
+    for (arma::uword c = 0; c != n_gma; ++c) {
+      w[c] = W(p, c);
+      std::uint64_t bits;
+      std::memcpy(&bits, &w[c], sizeof(bits));
+      h ^= std::hash<std::uint64_t>()(bits) + 0x9e3779b97f4a7c15ULL +
+           (h << 6) + (h >> 2);
+    }
+
+    arma::u32 id = static_cast<arma::u32>(rows.size() / n_gma);
+    auto range = seen.equal_range(h);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (std::memcmp(&rows[it->second * n_gma], w.data(),
+                      n_gma * sizeof(double)) == 0) {
+        id = it->second;
+        break;
+      }
+    }
+    if (id == rows.size() / n_gma) {
+      rows.insert(rows.end(), w.begin(), w.end());
+      seen.emplace(h, id);
+    }
+    lag_id_(p) = id;
+  }
+
+  arma::uword n_lag = rows.size() / n_gma;
+  table_.set_size(n_lag, n_gma);
+  for (arma::uword l = 0; l != n_lag; ++l)
+    for (arma::uword c = 0; c != n_gma; ++c)
+      table_(l, c) = rows[l * n_gma + c];
+}
+
+inline void LagTable::Multiply(const arma::vec& gamma, arma::vec& Wgma) const {
+  arma::vec lag_gma = table_ * gamma;
+
+  Wgma.set_size(lag_id_.n_elem);
+  const arma::u32* id = lag_id_.memptr();
+  double* out = Wgma.memptr();
+  for (arma::uword p = 0; p != lag_id_.n_elem; ++p) out[p] = lag_gma(id[p]);
+}
+
+inline arma::mat LagTable::Expand(arma::uword first, arma::uword n) const {
+  arma::mat W(n, table_.n_cols);
+  for (arma::uword p = 0; p != n; ++p)
+    W.row(p) = table_.row(lag_id_(first + p));
+
+  return W;
+}
+
+}  // namespace jmcm
+
+#endif  // JMCM_SRC_LAG_TABLE_H_
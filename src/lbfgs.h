@@ -0,0 +1,85 @@
+//  lbfgs.h: limited-memory BFGS for wide designs
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_LBFGS_H_
+#define JMCM_LBFGS_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+
+#include "linesearch.h"
+#include "optim_stats.h"
+#include <RcppArmadillo.h>
+
+namespace pan {
+
+// The quasi-Newton method of BFGS with the inverse Hessian kept as the
+// last history pairs (s, y) of steps and gradient changes, applied to the
+// gradient by the two-loop recursion. An iteration takes O(history n_pars)
+// in place of the O(n_pars^2) of BFGS. T must provide ValueAndGradient
+// (see JmcmBase), by which the start is evaluated.
+template <typename T>
+class LBFGS : public LineSearch<T> {
+ public:
+  LBFGS();
+  ~LBFGS();
+
+  void set_trace(bool trace) { trace_ = trace; }
+  void set_history(int history) { history_ = std::max(history, 1); }
+  // With warm_start, the pairs are kept at the end of Optimize and the next
+  // Optimize over as many parameters starts from them. The initial inverse
+  // Hessian s'y / y'y I is rescaled by every new pair, so that the kept
+  // pairs give way to those of the changed objective.
+  void set_warm_start(bool warm_start) {
+    warm_start_ = warm_start;
+    if (!warm_start) n_pairs_ = 0;
+  }
+  // the kept pairs, oldest first, as [s, y], and the pairs to start from
+  arma::mat curvature() const;
+  void set_curvature(const arma::mat& pairs);
+  void Optimize(T& func, arma::vec& x, const double grad_tol = 1e-6);
+  int n_iters() const;
+  double f_min() const;
+  StopReason stop_reason() const { return stop_reason_; }
+
+ private:
+  bool trace_;
+  int history_;
+  int n_iters_;
+  double f_min_;
+  StopReason stop_reason_;
+  bool warm_start_;
+
+  // History of the steps s and the gradient changes y, rho = 1 / (y's),
+  // the newest pair in column newest_, going back n_pairs_ columns
+  // cyclically
+  arma::mat s_, y_;
+  arma::vec rho_;
+  int newest_, n_pairs_;
+
+  // -H grad for the pairs kept
+  arma::vec Direction(const arma::vec& grad) const;
+};  // class LBFGS
+
+#include "lbfgs_impl.h"
+
+}  // namespace pan
+
+#endif  // JMCM_LBFGS_H_
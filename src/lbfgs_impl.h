@@ -0,0 +1,218 @@
+//  lbfgs_impl.h: limited-memory BFGS for wide designs
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+/**
+ * Constructor
+ */
+template <typename T>
+LBFGS<T>::LBFGS()
+    : LineSearch<T>(),
+      trace_(false),
+      history_(6),
+      n_iters_(0),
+      f_min_(0),
+      stop_reason_(StopReason::kNone),
+      warm_start_(false),
+      newest_(-1),
+      n_pairs_(0) {}
+
+/**
+ * Destructor
+ */
+template <typename T>
+LBFGS<T>::~LBFGS() {}
+
+/**
+ * Implement the limited-memory quasi-Newton method
+ *
+ * @param func Instance of function to be optimized
+ * @param x Parameters
+ * @param grad_tol The convergence requirement on zeroing the gradient
+ */
+template <typename T>
+void LBFGS<T>::Optimize(T &func, arma::vec &x, const double grad_tol) {
+  // Maximum number of iterations
+  const int kIterMax = 200;
+
+  // Machine precision
+  const double kEpsilon = std::numeric_limits<double>::epsilon();
+
+  // Convergence criterion on x values
+  const double kTolX = 4 * kEpsilon;
+
+  // Scaled maximum step length allowed in line searches
+  const double kScaStepMax = 100;
+
+  const int n_pars = x.n_rows;  // number of parameters
+
+  // Calculate starting function value and gradient
+  double f;
+  arma::vec grad;
+  func.ValueAndGradient(x, f, grad);
+  f_min_ = f;
+
+  // Start from the pairs kept by the last Optimize, or else from none
+  if (!warm_start_ || s_.n_rows != arma::uword(n_pars) ||
+      s_.n_cols != arma::uword(history_)) {
+    s_.set_size(n_pars, history_);
+    y_.set_size(n_pars, history_);
+    rho_.set_size(history_);
+    newest_ = -1;
+    n_pairs_ = 0;
+  }
+
+  // The first step is along the steepest descent without pairs
+  arma::vec p = Direction(grad);
+
+  // Calculate the maximum step length
+  double sum = sqrt(arma::dot(x, x));
+  const double kStepMax = kScaStepMax * std::max(sum, double(n_pars));
+
+  // Main loop over the iterations
+  for (int iter = 0; iter != kIterMax; ++iter) {
+    n_iters_ = iter;
+
+    arma::vec x2 = x;        // Save the old point
+    arma::vec grad2 = grad;  // Save the old gradient
+
+    // Update the point and the function value, and for the Wolfe search
+    // the gradient
+    if (this->wolfe_)
+      f = this->GetWolfeStep(func, x, p, kStepMax, f, grad);
+    else
+      f = this->GetStep(func, x, p, kStepMax, f, grad);
+
+    p = x - x2;  // Update line direction
+    f_min_ = f;
+
+    if (trace_) {
+      Rcpp::Rcout << std::setw(5) << iter << ": " << std::setw(10) << f << ": ";
+      x.t().print();
+    }
+
+    // Test for convergence on Delta x
+    double test = 0.0;
+    for (int i = 0; i != n_pars; ++i) {
+      double temp = std::abs(p(i)) / std::max(std::abs(x(i)), 1.0);
+      if (temp > test) test = temp;
+    }
+    if (test < kTolX) {
+      stop_reason_ = StopReason::kTolX;
+      return;
+    }
+
+    if (!this->wolfe_) func.Gradient(x, grad);  // Get the new gradient
+
+    // Test for convergence on zero gradient
+    test = 0.0;
+    double den = std::max(f, 1.0);
+    for (int i = 0; i != n_pars; ++i) {
+      double temp = std::abs(grad(i)) * std::max(std::abs(x(i)), 1.0) / den;
+      if (temp > test) test = temp;
+    }
+    if (test < grad_tol) {
+      stop_reason_ = StopReason::kGradTol;
+      return;
+    }
+
+    // Keep the pair unless y's is not sufficiently positive, as in BFGS
+    arma::vec dg = grad - grad2;
+    double fac = arma::dot(dg, p);
+    if (fac > sqrt(kEpsilon * arma::dot(dg, dg) * arma::dot(p, p))) {
+      newest_ = (newest_ + 1) % history_;
+      s_.col(newest_) = p;
+      y_.col(newest_) = dg;
+      rho_(newest_) = 1.0 / fac;
+      n_pairs_ = std::min(n_pairs_ + 1, history_);
+    }
+
+    // Calculate the next direction to go
+    p = Direction(grad);
+  }
+  stop_reason_ = StopReason::kMaxIter;
+  if (this->message_) {
+    Rcpp::Rcerr << "too many iterations in lbfgs" << std::endl;
+  }
+}
+
+template <typename T>
+arma::vec LBFGS<T>::Direction(const arma::vec &grad) const {
+  arma::vec q = grad;
+  if (n_pairs_ == 0) return -q;
+
+  arma::vec alpha(n_pairs_);
+  int k = newest_;
+  for (int j = 0; j != n_pairs_; ++j) {
+    alpha(j) = rho_(k) * arma::dot(s_.col(k), q);
+    q -= alpha(j) * y_.col(k);
+    k = (k + history_ - 1) % history_;
+  }
+
+  // the initial inverse Hessian s'y / y'y I of the newest pair
+  q *= 1.0 / (rho_(newest_) * arma::dot(y_.col(newest_), y_.col(newest_)));
+
+  for (int j = n_pairs_ - 1; j >= 0; --j) {
+    k = (k + 1) % history_;
+    double beta = rho_(k) * arma::dot(y_.col(k), q);
+    q += (alpha(j) - beta) * s_.col(k);
+  }
+
+  return -q;
+}
+
+template <typename T>
+arma::mat LBFGS<T>::curvature() const {
+  arma::mat pairs(s_.n_rows, 2 * n_pairs_);
+  int k = newest_;
+  for (int j = n_pairs_ - 1; j >= 0; --j) {
+    pairs.col(j) = s_.col(k);
+    pairs.col(n_pairs_ + j) = y_.col(k);
+    k = (k + history_ - 1) % history_;
+  }
+
+  return pairs;
+}
+
+template <typename T>
+void LBFGS<T>::set_curvature(const arma::mat &pairs) {
+  int n_pairs = std::min(int(pairs.n_cols / 2), history_);
+  s_.set_size(pairs.n_rows, history_);
+  y_.set_size(pairs.n_rows, history_);
+  rho_.set_size(history_);
+  newest_ = -1;
+  n_pairs_ = 0;
+
+  // the newest n_pairs of them
+  for (int j = pairs.n_cols / 2 - n_pairs; j != int(pairs.n_cols / 2); ++j) {
+    newest_ = (newest_ + 1) % history_;
+    s_.col(newest_) = pairs.col(j);
+    y_.col(newest_) = pairs.col(pairs.n_cols / 2 + j);
+    rho_(newest_) = 1.0 / arma::dot(s_.col(newest_), y_.col(newest_));
+    ++n_pairs_;
+  }
+}
+
+template <typename T>
+int LBFGS<T>::n_iters() const {
+  return n_iters_;
+}
+
+template <typename T>
+double LBFGS<T>::f_min() const {
+  return f_min_;
+}
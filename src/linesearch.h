@@ -19,13 +19,37 @@ class LineSearch {
   LineSearch();   // Constructor
   ~LineSearch();  // Destructor
 
-  void GetStep(T &func, arma::vec &x, arma::vec &p, const double kStepMax);
+  // Backtracks from x along p, given fold = func(x) and grad = the gradient
+  // at x, which the caller already holds. Returns func at the new x.
+  double GetStep(T &func, arma::vec &x, arma::vec &p, const double kStepMax,
+                 const double fold, const arma::vec &grad);
+
+  // Line search for the strong Wolfe conditions from x along p, given fold
+  // and grad at x. Returns func at the new x, and the gradient there in
+  // grad. T must provide ValueAndGradient (see JmcmBase).
+  double GetWolfeStep(T &func, arma::vec &x, arma::vec &p,
+                      const double kStepMax, const double fold,
+                      arma::vec &grad);
 
   void set_message(bool message) { message_ = message; }
+  // whether the optimizers use GetWolfeStep in place of GetStep
+  void set_wolfe(bool wolfe) { wolfe_ = wolfe; }
+
+  // trial steps after the first of the searches so far, i.e. the values
+  // spent on backtracking (and for the Wolfe search, on extrapolation)
+  double n_backtracks() const { return n_backtracks_; }
+  void ResetBacktracks() { n_backtracks_ = 0; }
 
  protected:
   bool message_;
+  bool wolfe_;
+  double n_backtracks_;
   bool IsInfOrNaN(double x);
+
+  // minimizer of the cubic with the values and slopes at a and b, NaN if
+  // it has none
+  static double CubicMin(double a, double fa, double da, double b, double fb,
+                         double db);
 };  // class LineSearch
 
 #include "linesearch_impl.h"
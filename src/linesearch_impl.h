@@ -3,7 +3,8 @@
 // Written by Yi Pan - ypan1988@gmail.com
 
 template <typename T>
-LineSearch<T>::LineSearch() {}
+LineSearch<T>::LineSearch()
+    : message_(false), wolfe_(false), n_backtracks_(0) {}
 
 template <typename T>
 LineSearch<T>::~LineSearch() {}
@@ -17,8 +18,9 @@ LineSearch<T>::~LineSearch() {}
  * @param stepmax Maximum step length
  */
 template <typename T>
-void LineSearch<T>::GetStep(T &func, arma::vec &x, arma::vec &p,
-                            const double stepmax) {
+double LineSearch<T>::GetStep(T &func, arma::vec &x, arma::vec &p,
+                              const double stepmax, const double fold,
+                              const arma::vec &grad) {
   int debug = 0;
 
   // Maximum number of iterations
@@ -33,9 +35,6 @@ void LineSearch<T>::GetStep(T &func, arma::vec &x, arma::vec &p,
   const int n_pars = x.n_rows;  // number of parameters
 
   const arma::vec xold = x;
-  const double fold = func(xold);
-  arma::vec grad;
-  func.Gradient(xold, grad);
 
   // Scale if attempted step is too big
   double sum = sqrt(arma::dot(p, p));
@@ -58,6 +57,7 @@ void LineSearch<T>::GetStep(T &func, arma::vec &x, arma::vec &p,
   lambda2 = lambda_tmp = f = f2 = 0.0;
   for (int iter = 0; iter != kIterMax; ++iter) {
     // Start of iteration loop
+    if (iter != 0) ++n_backtracks_;
     x = xold + lambda * p;
     f = func(x);
 
@@ -69,16 +69,17 @@ void LineSearch<T>::GetStep(T &func, arma::vec &x, arma::vec &p,
     if (lambda < stepmin) {
       // x is too close to xold, ignored
       x = xold;
-      return;
+      return fold;
     } else if (f <= fold + kAlpha * lambda * slope) {
       // Sufficient function decrease
-      return;
+      return f;
     } else if (IsInfOrNaN(f)) {
       // f is INF or NAN
       while (!IsInfOrNaN(lambda) && IsInfOrNaN(f)) {
         lambda *= 0.5;
         x = xold + lambda * p;
         f = func(x);
+        ++n_backtracks_;
       }
 
       if (debug) {
@@ -130,6 +131,140 @@ void LineSearch<T>::GetStep(T &func, arma::vec &x, arma::vec &p,
                   << "\tlambda = " << lambda << "\tf = " << f << std::endl;
     }
   }
+
+  return f;
+}
+
+/**
+ * Line search for the strong Wolfe conditions
+ *   f(x + a p) <= f(x) + c1 a grad' p,  |g(x + a p)' p| <= c2 |grad' p|
+ * in the manner of More and Thuente: the step is doubled until an interval
+ * bracketing such steps is found, which is then narrowed by safeguarded
+ * cubic interpolation (Nocedal and Wright, Algorithms 3.5 and 3.6). The
+ * curvature condition makes y's > 0 for the BFGS update. If the search
+ * fails, the best step with sufficient decrease is taken, if any.
+ *
+ * @param func Instance of function to be optimized
+ * @param x Parameters
+ * @param p Newton step
+ * @param stepmax Maximum step length
+ * @param fold Function value at x
+ * @param grad Gradient at x, replaced by the gradient at the new x
+ */
+template <typename T>
+double LineSearch<T>::GetWolfeStep(T &func, arma::vec &x, arma::vec &p,
+                                   const double stepmax, const double fold,
+                                   arma::vec &grad) {
+  // Maximum number of function evaluations
+  const int kIterMax = 30;
+
+  // Sufficient decrease and curvature constants
+  const double kC1 = 1.0e-4;
+  const double kC2 = 0.9;
+
+  // The convergence criterion on Delta X
+  const double kTolX = std::numeric_limits<double>::epsilon();
+
+  const int n_pars = x.n_rows;  // number of parameters
+
+  const arma::vec xold = x;
+
+  // Scale if attempted step is too big
+  double sum = sqrt(arma::dot(p, p));
+  if (sum > stepmax) {
+    p *= stepmax / sum;
+    sum = stepmax;
+  }
+
+  const double slope = arma::dot(grad, p);
+  if (slope >= 0.0) {
+    if (message_)
+      Rcpp::Rcerr << "Roundoff problem in linesearch." << std::endl;
+    return fold;
+  }
+
+  // Calculate the minimum and maximum step lengths
+  double test = 0.0;
+  for (int i = 0; i != n_pars; ++i) {
+    double temp = std::abs(p(i)) / std::max(std::abs(xold(i)), 1.0);
+    if (temp > test) test = temp;
+  }
+  const double stepmin = kTolX / test;
+  const double step_limit = stepmax / sum;
+
+  // lo is the best step so far with sufficient decrease; once bracketed,
+  // the steps for the Wolfe conditions lie between lo and hi
+  double a_lo = 0.0, f_lo = fold, d_lo = slope;
+  double a_hi = 0.0, f_hi = 0.0, d_hi = 0.0;
+  arma::vec g_lo = grad;
+  bool bracketed = false;
+
+  double a = 1.0;  // Always try full Newton step first
+  double f;
+  arma::vec g;
+  for (int iter = 0; iter != kIterMax; ++iter) {
+    if (iter != 0) ++n_backtracks_;
+    x = xold + a * p;
+    func.ValueAndGradient(x, f, g);
+    double d = arma::dot(g, p);
+
+    if (IsInfOrNaN(f) || f > fold + kC1 * a * slope || f >= f_lo) {
+      a_hi = a;
+      f_hi = f;
+      d_hi = d;
+      bracketed = true;
+    } else if (std::abs(d) <= -kC2 * slope) {
+      // Both conditions hold
+      grad = g;
+      return f;
+    } else {
+      if (d * (bracketed ? a_hi - a_lo : 1.0) >= 0.0) {
+        a_hi = a_lo;
+        f_hi = f_lo;
+        d_hi = d_lo;
+        bracketed = true;
+      }
+      a_lo = a;
+      f_lo = f;
+      d_lo = d;
+      g_lo = g;
+    }
+
+    if (bracketed) {
+      // Interpolate, bisecting if the cubic is close to either end
+      double width = std::abs(a_hi - a_lo);
+      if (width < stepmin) break;
+      a = CubicMin(a_lo, f_lo, d_lo, a_hi, f_hi, d_hi);
+      double lower = std::min(a_lo, a_hi) + 0.1 * width;
+      double upper = std::max(a_lo, a_hi) - 0.1 * width;
+      if (IsInfOrNaN(a) || a < lower || a > upper) a = 0.5 * (a_lo + a_hi);
+    } else {
+      // Extrapolate
+      if (a >= step_limit) break;
+      a = std::min(2.0 * a, step_limit);
+    }
+  }
+
+  if (a_lo > 0.0) {
+    x = xold + a_lo * p;
+    grad = g_lo;
+    return f_lo;
+  }
+
+  // x is too close to xold, ignored
+  x = xold;
+  return fold;
+}
+
+template <typename T>
+double LineSearch<T>::CubicMin(double a, double fa, double da, double b,
+                               double fb, double db) {
+  double d1 = da + db - 3.0 * (fa - fb) / (a - b);
+  double disc = d1 * d1 - da * db;
+  if (!(disc >= 0.0)) return std::numeric_limits<double>::quiet_NaN();
+
+  double d2 = (b > a ? 1.0 : -1.0) * sqrt(disc);
+  return b - (b - a) * (db + d2 - d1) / (db - da + 2.0 * d2);
 }
 
 template <typename T>
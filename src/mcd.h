@@ -20,13 +20,17 @@
 #ifndef JMCM_SRC_MCD_H_
 #define JMCM_SRC_MCD_H_
 
+#include <cmath>
+
 #include <algorithm>  // std::equal
+#include <memory>
 
 #define ARMA_DONT_PRINT_ERRORS
 #include <RcppArmadillo.h>
 
 #include "arma_util.h"
 #include "jmcm_base.h"
+#include "packed_tri.h"
 
 namespace jmcm {
 
@@ -38,8 +42,11 @@ class MCD : public JmcmBase {
 
   MCD(const arma::vec& m, const arma::vec& Y, const arma::mat& X,
       const arma::mat& Z, const arma::mat& W);
+  explicit MCD(std::shared_ptr<const JmcmData> data);
 
   void UpdateLambda(const arma::vec& x) override;
+  arma::uword FisherScoring(arma::vec& x, arma::uword max_iter = 50,
+                            double tol = 1e-8) override;
   void UpdateGamma() override;
 
   arma::mat get_D(arma::uword i) const override;
@@ -54,6 +61,8 @@ class MCD : public JmcmBase {
   void get_Sigma_inv(arma::uword i, arma::mat& Sigmai_inv) const;
   void get_Resid(arma::uword i, arma::vec& ri) const;
 
+  using JmcmBase::operator();
+  using JmcmBase::Gradient;
   double operator()(const arma::vec& x) override;
   void Gradient(const arma::vec& x, arma::vec& grad) override;
   void Grad1(arma::vec& grad1);
@@ -68,8 +77,23 @@ class MCD : public JmcmBase {
   arma::mat G_;
   arma::vec TResid_;
 
+  void Whiten(arma::uword i, double* v) const override;
+  void FactorDerivs(arma::uword i, arma::mat& B, arma::cube& dB,
+                    arma::cube* d2B) const override;
+  std::unique_ptr<JmcmBase> NewState() const override {
+    return std::unique_ptr<JmcmBase>(new MCD(data_));
+  }
+
+  // T_i = I - Phi_i read in place from the packed Wgma_
+  pan::PackedLowerTri packed_T(arma::uword i) const {
+    return pan::PackedLowerTri(Wgma_.memptr() + index_.pair_begin(i), m_(i),
+                               false, -1.0);
+  }
+
   arma::mat get_G(arma::uword i) const;
   arma::vec get_TResid(arma::uword i) const;
+  const arma::subview<double> view_G(arma::uword i) const;
+  const arma::vec view_TResid(arma::uword i) const;
   void get_G(arma::uword i, arma::mat& Gi) const;
   void get_TResid(arma::uword i, arma::vec& Tiri) const;
   void UpdateG();
@@ -79,9 +103,12 @@ class MCD : public JmcmBase {
 
 inline MCD::MCD(const arma::vec& m, const arma::vec& Y, const arma::mat& X,
                 const arma::mat& Z, const arma::mat& W)
-    : JmcmBase(m, Y, X, Z, W, 0) {
+    : MCD(std::make_shared<JmcmData>(m, Y, X, Z, W)) {}
+
+inline MCD::MCD(std::shared_ptr<const JmcmData> data)
+    : JmcmBase(std::move(data), 0) {
   arma::uword N = Y_.n_rows;
-  arma::uword n_gma = W_.n_cols;
+  arma::uword n_gma = lags_.n_cols();
 
   G_ = arma::zeros<arma::mat>(N, n_gma);
   TResid_ = arma::zeros<arma::vec>(N);
@@ -89,108 +116,106 @@ inline MCD::MCD(const arma::vec& m, const arma::vec& Y, const arma::mat& X,
 
 inline void MCD::UpdateLambda(const arma::vec& x) { set_lambda(x); }
 
-inline void MCD::UpdateGamma() {
-  arma::uword i, n_sub = m_.n_elem, n_gma = W_.n_cols;
-  arma::mat GDG = arma::zeros<arma::mat>(n_gma, n_gma);
-  arma::vec GDr = arma::zeros<arma::vec>(n_gma);
-
-  for (i = 0; i < n_sub; ++i) {
-    arma::mat Gi;
-    get_G(i, Gi);
-    arma::vec ri;
-    get_Resid(i, ri);
-    arma::mat Di;
-    get_D(i, Di);
-    arma::mat Di_inv = arma::diagmat(arma::pow(Di.diag(), -1));
-
-    GDG += Gi.t() * Di_inv * Gi;
-    GDr += Gi.t() * Di_inv * ri;
+inline arma::uword MCD::FisherScoring(arma::vec& x, arma::uword max_iter,
+                                      double tol) {
+  if (free_param_ != 2) return JmcmBase::FisherScoring(x, max_iter, tol);
+
+  // Given beta and gamma, -2l = sum_ij w_ij (eta_ij + s_ij exp(-eta_ij))
+  // with eta = Z lambda and s = (T_i r_i)^2 is the deviance of a gamma GLM
+  // with log link in s. Its working weights, and so its expected Hessian
+  // Z' W Z, do not depend on lambda: IRLS is Fisher scoring with a fixed
+  // matrix, each step a solve with Z' W Z for the working residuals. The
+  // values and scores are counted as evaluations of -2l and its gradient.
+  UpdateJmcm(x);
+  const arma::vec s = arma::square(TResid_);
+  auto n2loglik = [&](const arma::vec& y) {
+    ++eval_counts_.n_value;
+    arma::vec eta = Z_ * y;
+    return arma::accu(obs_weight_ % (eta + s % arma::exp(-eta)));
+  };
+  double f = n2loglik(x);
+
+  arma::vec step;
+  arma::uword iter = 0;
+  while (iter != max_iter) {
+    ++eval_counts_.n_gradient;
+    arma::vec u = obs_weight_ % (s % arma::exp(-(Z_ * x)) - 1.0);
+    pan::SolveSympd(ZWZ_, Z_.t() * u, step, &solver_stats_);
+
+    double change = DampedStep(n2loglik, step, x, f);
+    if (change < 0) break;
+    ++iter;
+    if (change < tol) break;
   }
+  set_lambda(x);
+
+  return iter;
+}
 
-  arma::vec gamma = GDG.i() * GDr;
+inline void MCD::UpdateGamma() {
+  arma::uword n_sub = m_.n_elem, n_gma = lags_.n_cols();
+
+  // [GDG, GDr] summed over chunks of subjects
+  const pan::ChunkPlan& chunks = subject_plan_;
+  arma::mat zero = arma::zeros<arma::mat>(n_gma, n_gma + 1);
+  arma::mat GDGr = pan::ParallelSum(
+      chunks, team(), zero, [&](arma::uword c, arma::mat& part) {
+        for (arma::uword i = chunks.begin(c); i != chunks.end(c); ++i) {
+          const arma::subview<double> Gi = view_G(i);
+          const arma::vec ri = view_Resid(i);
+          // D_i^{-1} G_i, times the weight of subject i
+          arma::mat DGi = Gi.each_col() % arma::exp(-view_Zlmd(i));
+          if (weighted_) DGi *= weight_(i);
+
+          part.head_cols(n_gma) += Gi.t() * DGi;
+          part.col(n_gma) += DGi.t() * ri;
+        }
+      });
+
+  arma::mat GDG = GDGr.head_cols(n_gma);
+  arma::vec GDr = GDGr.col(n_gma), gamma;
+  pan::SolveSympd(GDG, GDr, gamma, &solver_stats_);
 
   set_gamma(gamma);
 }
 
 inline arma::mat MCD::get_D(arma::uword i) const {
-  arma::mat Di = arma::eye(m_(i), m_(i));
-  if (i == 0)
-    Di = arma::diagmat(arma::exp(Zlmd_.subvec(0, m_(0) - 1)));
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    Di = arma::diagmat(arma::exp(Zlmd_.subvec(index, index + m_(i) - 1)));
-  }
-  return Di;
+  arma::uword first_index = index_.obs_begin(i);
+  return arma::diagmat(
+      arma::exp(Zlmd_.subvec(first_index, first_index + m_(i) - 1)));
 }
 
 inline void MCD::get_D(arma::uword i, arma::mat& Di) const {
-  Di = arma::eye(m_(i), m_(i));
-  if (i == 0)
-    Di = arma::diagmat(arma::exp(Zlmd_.subvec(0, m_(0) - 1)));
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    Di = arma::diagmat(arma::exp(Zlmd_.subvec(index, index + m_(i) - 1)));
-  }
+  arma::uword first_index = index_.obs_begin(i);
+  Di = arma::diagmat(
+      arma::exp(Zlmd_.subvec(first_index, first_index + m_(i) - 1)));
 }
 
 inline arma::mat MCD::get_T(arma::uword i) const {
-  arma::mat Ti = arma::eye(m_(i), m_(i));
-  if (m_(i) != 1) {
-    if (i == 0) {
-      arma::uword first_index = 0;
-      arma::uword last_index = m_(0) * (m_(0) - 1) / 2 - 1;
-
-      Ti = pan::ltrimat(m_(0), -Wgma_.subvec(first_index, last_index));
-    } else {
-      arma::uword first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) - 1) / 2;
-      }
-      arma::uword last_index = first_index + m_(i) * (m_(i) - 1) / 2 - 1;
-
-      Ti = pan::ltrimat(m_(i), -Wgma_.subvec(first_index, last_index));
-    }
-  }
-  return Ti;
+  return packed_T(i).Unpack();
 }
 
 inline void MCD::get_T(arma::uword i, arma::mat& Ti) const {
-  Ti = arma::eye(m_(i), m_(i));
-  if (m_(i) != 1) {
-    if (i == 0) {
-      arma::uword first_index = 0;
-      arma::uword last_index = m_(0) * (m_(0) - 1) / 2 - 1;
-
-      Ti = pan::ltrimat(m_(0), -Wgma_.subvec(first_index, last_index));
-    } else {
-      arma::uword first_index = 0;
-      for (arma::uword idx = 0; idx != i; ++idx) {
-        first_index += m_(idx) * (m_(idx) - 1) / 2;
-      }
-      arma::uword last_index = first_index + m_(i) * (m_(i) - 1) / 2 - 1;
-
-      Ti = pan::ltrimat(m_(i), -Wgma_.subvec(first_index, last_index));
-    }
-  }
+  packed_T(i).Unpack(Ti);
 }
 
 inline arma::vec MCD::get_mu(arma::uword i) const {
-  arma::vec mui;
-  if (i == 0)
-    mui = Xbta_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    mui = Xbta_.subvec(index, index + m_(i) - 1);
-  }
-  return mui;
+  arma::uword first_index = index_.obs_begin(i);
+  return Xbta_.subvec(first_index, first_index + m_(i) - 1);
 }
 
 inline arma::mat MCD::get_Sigma(arma::uword i) const {
-  arma::mat Ti = get_T(i);
-  arma::mat Ti_inv = arma::pinv(Ti);
-  arma::mat Di = get_D(i);
+  // T_i is unit lower triangular, so it is always invertible by substitution
+  arma::uword mi = m_(i);
+  arma::vec Ti_inv(pan::PackedLowerTri::size(mi, true));
+  pan::InvertLowerTri(packed_T(i), Ti_inv.memptr(), &solver_stats_);
+
+  // T_i^{-1} D_i^{1/2}, so that Sigma_i = B B'
+  arma::mat B;
+  pan::PackedLowerTri(Ti_inv.memptr(), mi, true).Unpack(B);
+  B.each_row() %= arma::exp(view_Zlmd(i) / 2).t();
 
-  return Ti_inv * Di * Ti_inv.t();
+  return B * B.t();
 }
 
 inline arma::mat MCD::get_Sigma_inv(arma::uword i) const {
@@ -212,46 +237,46 @@ inline void MCD::get_Sigma_inv(arma::uword i, arma::mat& Sigmai_inv) const {
 }
 
 inline arma::vec MCD::get_Resid(arma::uword i) const {
-  arma::vec ri;
-  if (i == 0)
-    ri = Resid_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    ri = Resid_.subvec(index, index + m_(i) - 1);
-  }
-  return ri;
+  arma::uword first_index = index_.obs_begin(i);
+  return Resid_.subvec(first_index, first_index + m_(i) - 1);
 }
 
 inline void MCD::get_Resid(arma::uword i, arma::vec& ri) const {
-  if (i == 0)
-    ri = Resid_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    ri = Resid_.subvec(index, index + m_(i) - 1);
-  }
+  arma::uword first_index = index_.obs_begin(i);
+  ri = Resid_.subvec(first_index, first_index + m_(i) - 1);
 }
 
 inline double MCD::operator()(const arma::vec& x) {
+  ++eval_counts_.n_value;
   UpdateJmcm(x);
 
-  arma::uword i, n_sub = m_.n_elem;
-  double result = 0.0;
-  for (i = 0; i < n_sub; ++i) {
-    arma::vec ri;
-    get_Resid(i, ri);
-    arma::mat Sigmai_inv;
-    get_Sigma_inv(i, Sigmai_inv);
-    result += arma::as_scalar(ri.t() * Sigmai_inv * ri);
+  if (scatter_path()) {
+    // sum_i r_i' Sigma^{-1} r_i = tr(B R R' B'), B = D^{-1/2} T
+    double n_sub = m_.n_elem;
+    return arma::trace(WhitenedScatter()) +
+           n_sub * arma::accu(view_Zlmd(0));
   }
 
-  result += arma::sum(arma::log(arma::exp(Zlmd_)));
-  return result;
+  // with T_i r_i kept in TResid_: r_i' Sigma_i^{-1} r_i is the sum of
+  // (T_i r_i)_j^2 / D_ijj, and log|Sigma_i| = sum_j log D_ijj as |T_i| = 1
+  const double* zlmd = Zlmd_.memptr();
+  const double* tr = TResid_.memptr();
+  const double* w = obs_weight_.memptr();
+  const pan::ChunkPlan& chunks = subject_plan_;
+  return pan::ParallelSum(
+      chunks, team(), 0.0, [&](arma::uword c, double& part) {
+        arma::uword first = index_.obs_begin(chunks.begin(c)),
+                    last = index_.obs_begin(chunks.end(c));
+        for (arma::uword k = first; k != last; ++k)
+          part += w[k] * (std::exp(-zlmd[k]) * tr[k] * tr[k] + zlmd[k]);
+      });
 }
 
 inline void MCD::Gradient(const arma::vec& x, arma::vec& grad) {
+  ++eval_counts_.n_gradient;
   UpdateJmcm(x);
 
-  arma::uword n_bta = X_.n_cols, n_lmd = Z_.n_cols, n_gma = W_.n_cols;
+  arma::uword n_bta = X_.n_cols, n_lmd = Z_.n_cols, n_gma = lags_.n_cols();
 
   arma::vec grad1, grad2, grad3;
 
@@ -287,60 +312,134 @@ inline void MCD::Gradient(const arma::vec& x, arma::vec& grad) {
 }
 
 inline void MCD::Grad1(arma::vec& grad1) {
-  arma::uword i, n_sub = m_.n_elem, n_bta = X_.n_cols;
-  grad1 = arma::zeros<arma::vec>(n_bta);
-
-  for (i = 0; i < n_sub; ++i) {
-    arma::mat Xi = get_X(i);
-    arma::vec ri;
-    get_Resid(i, ri);
-    arma::mat Sigmai_inv;
-    get_Sigma_inv(i, Sigmai_inv);
-    grad1 += Xi.t() * Sigmai_inv * ri;
+  arma::uword n_sub = m_.n_elem;
+
+  // Sigma_i^{-1} r_i = T_i' D_i^{-1} T_i r_i stacked over subjects, so that
+  // the sum of the X_i' Sigma_i^{-1} r_i is a single product with X
+  arma::vec DTResid = arma::exp(-Zlmd_) % TResid_;
+  arma::vec SigmaResid(Resid_.n_rows);
+  if (balanced_) {
+    arma::mat T;
+    get_T(0, T);
+
+    arma::mat SR(SigmaResid.memptr(), m_(0), n_sub, false, true);
+    SR = T.t() * MatView(DTResid, m_(0), n_sub);
+  } else {
+    const pan::ChunkPlan& chunks = subject_plan_;
+    pan::ParallelFor(chunks, team(), [&](arma::uword c) {
+      for (arma::uword i = chunks.begin(c); i != chunks.end(c); ++i) {
+        arma::uword first_index = index_.obs_begin(i);
+        packed_T(i).MultiplyTrans(DTResid.memptr() + first_index,
+                                  SigmaResid.memptr() + first_index);
+      }
+    });
   }
+  patterns_.RecordSweep();
+  if (weighted_) SigmaResid %= obs_weight_;
 
-  grad1 *= -2;
+  grad1 = -2 * (X_.t() * SigmaResid);
 }
 
-inline void MCD::Grad2(arma::vec& grad2) {
-  arma::uword i, n_sub = m_.n_elem, n_lmd = Z_.n_cols;
-  grad2 = arma::zeros<arma::vec>(n_lmd);
+inline void MCD::Whiten(arma::uword i, double* v) const {
+  const double* zlmd = Zlmd_.memptr() + index_.obs_begin(i);
 
-  for (i = 0; i < n_sub; ++i) {
-    arma::vec one = arma::ones<arma::vec>(m_(i));
-    arma::mat Zi = get_Z(i);
-
-    arma::mat Di;
-    get_D(i, Di);
-    arma::mat Di_inv = arma::diagmat(arma::pow(Di.diag(), -1));
+  packed_T(i).Multiply(v, v);
+  for (arma::uword j = 0; j != m_(i); ++j) v[j] *= std::exp(-zlmd[j] / 2);
+}
 
-    arma::vec ei = arma::pow(get_TResid(i), 2);
+inline void MCD::FactorDerivs(arma::uword i, arma::mat& B, arma::cube& dB,
+                              arma::cube* d2B) const {
+  arma::uword mi = m_(i), n_lmd = Z_.n_cols, n_gma = lags_.n_cols(),
+              n_cov = n_lmd + n_gma;
+  const arma::mat Zi = view_Z(i);
+  const arma::vec d = arma::exp(-view_Zlmd(i) / 2);
 
-    grad2 += 0.5 * Zi.t() * (Di_inv * ei - one);
+  // B = D^{-1/2} T with T = I - Phi linear in gamma:
+  //   dB / dlambda_a = -diag(z_a) B / 2,  dB / dgamma_c = -D^{-1/2} G_c
+  // and the second derivatives in gamma vanish
+  arma::mat Ti;
+  get_T(i, Ti);
+  B = Ti.each_col() % d;
+  arma::cube G = PairSlices(i);
+
+  dB.set_size(mi, mi, n_cov);
+  for (arma::uword a = 0; a != n_lmd; ++a)
+    dB.slice(a) = -0.5 * (B.each_col() % Zi.col(a));
+  for (arma::uword c = 0; c != n_gma; ++c)
+    dB.slice(n_lmd + c) = -(G.slice(c).each_col() % d);
+  if (d2B == nullptr) return;
+
+  d2B->zeros(mi, mi, n_cov * (n_cov + 1) / 2);
+  for (arma::uword a = 0; a != n_cov; ++a) {
+    for (arma::uword b = 0; b <= a && b < n_lmd; ++b) {
+      arma::mat& d2 = d2B->slice(a * (a + 1) / 2 + b);
+      if (a < n_lmd)
+        d2 = 0.25 * (B.each_col() % (Zi.col(a) % Zi.col(b)));
+      else
+        d2 = -0.5 * (dB.slice(a).each_col() % Zi.col(b));
+    }
   }
-
-  grad2 *= -2;
 }
 
-inline void MCD::Grad3(arma::vec& grad3) {
-  arma::uword i, n_sub = m_.n_elem, n_gma = W_.n_cols;
-  grad3 = arma::zeros<arma::vec>(n_gma);
-
-  for (i = 0; i < n_sub; ++i) {
-    arma::mat Gi;
-    get_G(i, Gi);
+inline void MCD::Grad2(arma::vec& grad2) {
+  if (scatter_path()) {
+    // Z_i = Z_0 and sum_i (T r_i)_j^2 = (T R R' T')_jj
+    double n_sub = m_.n_elem;
+    arma::mat T;
+    get_T(0, T);
+    arma::vec q = arma::sum((T * scatter_) % T, 1);
+    arma::vec u = arma::exp(-view_Zlmd(0)) % q - n_sub;
+
+    grad2 = -(view_Z(0).t() * u);
+    return;
+  }
 
-    arma::mat Di;
-    get_D(i, Di);
-    arma::mat Di_inv = arma::diagmat(arma::pow(Di.diag(), -1));
+  // sum_i 0.5 * Z_i' (D_i^{-1} (T_i r_i)^2 - 1), all subjects at once
+  arma::vec u = arma::exp(-Zlmd_) % arma::square(TResid_) - 1.0;
+  if (weighted_) u %= obs_weight_;
 
-    arma::vec Tiri;
-    get_TResid(i, Tiri);
+  grad2 = -(Z_.t() * u);
+}
 
-    grad3 += Gi.t() * Di_inv * Tiri;
+inline void MCD::Grad3(arma::vec& grad3) {
+  if (scatter_path()) {
+    // sum_i (T r_i)_j r_ik = (T R R')_jk for the pairs (j, k) shared by
+    // all the subjects
+    arma::mat T;
+    get_T(0, T);
+    const arma::mat TS = T * scatter_;
+    const arma::vec d_inv = arma::exp(-view_Zlmd(0));
+
+    arma::vec c = arma::zeros<arma::vec>(lags_.n_lag());
+    for (arma::uword j = 1; j < m_(0); ++j)
+      for (arma::uword k = 0; k < j; ++k)
+        c(lags_.lag_id(index_.pair_index(0, j, k))) += d_inv(j) * TS(j, k);
+
+    grad3 = -2 * lags_.MultiplyTrans(c);
+    return;
   }
 
-  grad3 *= -2;
+  arma::vec u = arma::exp(-Zlmd_) % TResid_;
+  if (weighted_) u %= obs_weight_;
+
+  // sum_i G_i' D_i^{-1} T_i r_i = sum_{pairs} u_ij r_ik W_ijk, with the
+  // scalar weights summed per distinct lag before the product with W
+  const pan::ChunkPlan& chunks = subject_plan_;
+  arma::vec zero = arma::zeros<arma::vec>(lags_.n_lag());
+  arma::vec c = pan::ParallelSum(
+      chunks, team(), zero, [&](arma::uword ch, arma::vec& part) {
+        for (arma::uword i = chunks.begin(ch); i != chunks.end(ch); ++i) {
+          arma::uword first_index = index_.obs_begin(i);
+          for (arma::uword j = 1; j < m_(i); ++j) {
+            double uij = u(first_index + j);
+            for (arma::uword k = 0; k < j; ++k)
+              part(lags_.lag_id(index_.pair_index(i, j, k))) +=
+                  uij * Resid_(first_index + k);
+          }
+        }
+      });
+
+  grad3 = -2 * lags_.MultiplyTrans(c);
 }
 
 inline void MCD::UpdateJmcm(const arma::vec& x) {
@@ -369,6 +468,7 @@ inline void MCD::UpdateJmcm(const arma::vec& x) {
   }
 
   if (update) {
+    ++eval_counts_.n_update;
     UpdateParam(x);
     UpdateModel();
   } else {
@@ -379,7 +479,7 @@ inline void MCD::UpdateJmcm(const arma::vec& x) {
 inline void MCD::UpdateParam(const arma::vec& x) {
   arma::uword n_bta = X_.n_cols;
   arma::uword n_lmd = Z_.n_cols;
-  arma::uword n_gma = W_.n_cols;
+  arma::uword n_gma = lags_.n_cols();
 
   switch (free_param_) {
     case 0:
@@ -418,8 +518,8 @@ inline void MCD::UpdateModel() {
         Xbta_ = X_ * beta_;
 
       Zlmd_ = Z_ * lambda_;
-      Wgma_ = W_ * gamma_;
-      Resid_ = Y_ - Xbta_;
+      lags_.Multiply(gamma_, Wgma_);
+      UpdateResid();
 
       UpdateG();
       UpdateTResid();
@@ -432,7 +532,7 @@ inline void MCD::UpdateModel() {
       else
         Xbta_ = X_ * beta_;
 
-      Resid_ = Y_ - Xbta_;
+      UpdateResid();
 
       UpdateG();
       UpdateTResid();
@@ -445,7 +545,7 @@ inline void MCD::UpdateModel() {
       break;
 
     case 3:
-      Wgma_ = W_ * gamma_;
+      lags_.Multiply(gamma_, Wgma_);
 
       UpdateTResid();
 
@@ -456,89 +556,67 @@ inline void MCD::UpdateModel() {
   }
 }
 
-inline arma::mat MCD::get_G(arma::uword i) const {
-  arma::mat Gi;
-  if (i == 0)
-    Gi = G_.rows(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    Gi = G_.rows(index, index + m_(i) - 1);
-  }
-  return Gi;
-}
+inline arma::mat MCD::get_G(arma::uword i) const { return view_G(i); }
 
-inline void MCD::get_G(arma::uword i, arma::mat& Gi) const {
-  if (i == 0)
-    Gi = G_.rows(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    Gi = G_.rows(index, index + m_(i) - 1);
-  }
-}
+inline void MCD::get_G(arma::uword i, arma::mat& Gi) const { Gi = view_G(i); }
 
 inline arma::vec MCD::get_TResid(arma::uword i) const {
-  arma::vec Tiri;
-  if (i == 0)
-    Tiri = TResid_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    Tiri = TResid_.subvec(index, index + m_(i) - 1);
-  }
-  return Tiri;
+  return view_TResid(i);
 }
 
 inline void MCD::get_TResid(arma::uword i, arma::vec& Tiri) const {
-  if (i == 0)
-    Tiri = TResid_.subvec(0, m_(0) - 1);
-  else {
-    arma::uword index = arma::sum(m_.subvec(0, i - 1));
-    Tiri = TResid_.subvec(index, index + m_(i) - 1);
-  }
+  Tiri = view_TResid(i);
+}
+
+inline const arma::subview<double> MCD::view_G(arma::uword i) const {
+  arma::uword first_index = index_.obs_begin(i);
+  return G_.rows(first_index, first_index + m_(i) - 1);
+}
+
+inline const arma::vec MCD::view_TResid(arma::uword i) const {
+  return ColView(TResid_, index_.obs_begin(i), m_(i));
 }
 
 inline void MCD::UpdateG() {
-  arma::uword i, j, n_sub = m_.n_elem;
-
-  for (i = 0; i < n_sub; ++i) {
-    arma::mat Gi = arma::zeros<arma::mat>(m_(i), W_.n_cols);
-
-    arma::mat Wi = get_W(i);
-    arma::vec ri;
-    get_Resid(i, ri);
-    for (j = 1; j != m_(i); ++j) {
-      arma::uword index = 0;
-      if (j == 1)
-        index = 0;
-      else {
-        for (arma::uword idx = 1; idx < j; ++idx) index += idx;
+  const pan::ChunkPlan& chunks = subject_plan_;
+  pan::ParallelFor(chunks, team(), [&](arma::uword c) {
+    for (arma::uword i = chunks.begin(c); i != chunks.end(c); ++i) {
+      arma::uword first_index = index_.obs_begin(i);
+      const arma::vec ri = view_Resid(i);
+
+      // row j of G_i is sum_{k < j} r_ik * W_ijk'
+      G_.rows(first_index, first_index + m_(i) - 1).zeros();
+      for (arma::uword j = 1; j < m_(i); ++j) {
+        for (arma::uword k = 0; k < j; ++k)
+          G_.row(first_index + j) +=
+              ri(k) * lags_.row(index_.pair_index(i, j, k));
       }
-      Gi.row(j) = ri.subvec(0, j - 1).t() * Wi.rows(index, index + j - 1);
     }
-    if (i == 0)
-      G_.rows(0, m_(0) - 1) = Gi;
-    else {
-      arma::uword index = arma::sum(m_.subvec(0, i - 1));
-      G_.rows(index, index + m_(i) - 1) = Gi;
-    }
-  }
+  });
 }
 
 inline void MCD::UpdateTResid() {
-  arma::uword i, n_sub = m_.n_elem;
-
-  for (i = 0; i < n_sub; ++i) {
-    arma::vec ri;
-    get_Resid(i, ri);
-    arma::mat Ti;
-    get_T(i, Ti);
-    arma::mat Tiri = Ti * ri;
-    if (i == 0)
-      TResid_.subvec(0, m_(0) - 1) = Tiri;
-    else {
-      arma::uword index = arma::sum(m_.subvec(0, i - 1));
-      TResid_.subvec(index, index + m_(i) - 1) = Tiri;
-    }
+  arma::uword n_sub = m_.n_elem;
+
+  if (balanced_) {
+    arma::mat T;
+    get_T(0, T);
+
+    arma::mat TR(TResid_.memptr(), m_(0), n_sub, false, true);
+    TR = T * MatView(Resid_, m_(0), n_sub);
+    patterns_.RecordSweep();
+    return;
   }
+
+  const pan::ChunkPlan& chunks = subject_plan_;
+  pan::ParallelFor(chunks, team(), [&](arma::uword c) {
+    for (arma::uword i = chunks.begin(c); i != chunks.end(c); ++i) {
+      arma::uword first_index = index_.obs_begin(i);
+      packed_T(cov_rep(i)).Multiply(Resid_.memptr() + first_index,
+                                    TResid_.memptr() + first_index);
+    }
+  });
+  patterns_.RecordSweep();
 }
 
 }  // namespace jmcm
@@ -0,0 +1,253 @@
+//  model_search.h: fits of a grid of polynomial degrees and covariance
+//                  structures (MCD/ACD/HPC) for model selection
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_SRC_MODEL_SEARCH_H_
+#define JMCM_SRC_MODEL_SEARCH_H_
+
+#define ARMA_DONT_PRINT_ERRORS
+#include <RcppArmadillo.h>
+
+#include <cmath>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "acd.h"
+#include "hpc.h"
+#include "jmcm_base.h"
+#include "jmcm_fit.h"
+#include "mcd.h"
+#include "parallel.h"
+
+namespace jmcm {
+
+// The designs of ldFormula for the triple (p, d, q) are
+//   X = [1, t, ..., t^p, covariates of the mean]
+//   Z = [1, t, ..., t^d, covariates of the variances]
+//   W = [1, lag, ..., lag^q]
+// so all the models of the grid 1 <= p <= P, 1 <= d <= D, 1 <= q <= Q are
+// column subsets of the designs for (P, D, Q), which are built (and W
+// hashed into lags and patterns) once. Each model starts from the fit of
+// a neighbour with a smaller degree that did not fail, its theta padded
+// with zeros for the new terms. With level p + d + q, the models of a level
+// only depend on the level below, so the levels are fitted in turn and the
+// models of a level (for all the covariance structures) in parallel.
+class ModelSearch {
+ public:
+  // full holds the designs for max_triple = (P, D, Q); start is (beta,
+  // lambda) for the triple (1, 1, 1), to which gamma = 0 is added (with the
+  // first angle at pi / 2 for HPC); method_ids are those of the models to
+  // fit (0 = MCD, 1 = ACD, 2 = HPC)
+  ModelSearch(std::shared_ptr<const JmcmData> full,
+              const arma::uvec& max_triple, const arma::uvec& method_ids,
+              const arma::vec& start);
+
+  void Run(int n_threads);
+
+  // the fits, ordered by method, then p, d and q
+  arma::uword n_fits() const { return method_ids_.n_elem * n_triples_; }
+  arma::uword method_id(arma::uword k) const {
+    return method_ids_(k / n_triples_);
+  }
+  arma::uvec triple(arma::uword k) const;
+  const arma::vec& theta(arma::uword k) const { return theta_[k]; }
+  double f_min(arma::uword k) const { return f_min_(k); }
+  arma::uword n_iters(arma::uword k) const { return n_iters_(k); }
+  // whether the fit threw or ended at a point that is not finite, in which
+  // case theta is its start and f_min is NaN
+  bool failed(arma::uword k) const { return failed_(k) != 0; }
+
+ private:
+  std::shared_ptr<const JmcmData> full_;
+  arma::uword P_, D_, Q_, n_cov_x_, n_cov_z_, n_triples_;
+  arma::uvec method_ids_;
+  arma::vec start_;
+
+  std::vector<arma::vec> theta_;
+  arma::vec f_min_;
+  arma::uvec n_iters_, failed_;
+
+  // triples are numbered ((p - 1) D + d - 1) Q + q - 1
+  arma::uword triple_id(arma::uword p, arma::uword d, arma::uword q) const {
+    return ((p - 1) * D_ + d - 1) * Q_ + q - 1;
+  }
+
+  std::shared_ptr<const JmcmData> SubData(const arma::uvec& t) const;
+  arma::vec Start(arma::uword k) const;
+  arma::vec Pad(const arma::vec& x, const arma::uvec& from,
+                const arma::uvec& to) const;
+  void Fit(arma::uword k, std::shared_ptr<const JmcmData> data);
+};
+
+inline ModelSearch::ModelSearch(std::shared_ptr<const JmcmData> full,
+                                const arma::uvec& max_triple,
+                                const arma::uvec& method_ids,
+                                const arma::vec& start)
+    : full_(std::move(full)),
+      P_(max_triple(0)),
+      D_(max_triple(1)),
+      Q_(max_triple(2)),
+      n_cov_x_(full_->X.n_cols - P_ - 1),
+      n_cov_z_(full_->Z.n_cols - D_ - 1),
+      n_triples_(P_ * D_ * Q_),
+      method_ids_(method_ids),
+      start_(start),
+      theta_(n_fits()),
+      f_min_(n_fits()),
+      n_iters_(n_fits()),
+      failed_(arma::zeros<arma::uvec>(n_fits())) {}
+
+inline arma::uvec ModelSearch::triple(arma::uword k) const {
+  arma::uword t = k % n_triples_;
+  arma::uvec result = {t / (D_ * Q_) + 1, t / Q_ % D_ + 1, t % Q_ + 1};
+
+  return result;
+}
+
+inline std::shared_ptr<const JmcmData> ModelSearch::SubData(
+    const arma::uvec& t) const {
+  // the polynomial columns up to degree p (or d), then the covariates
+  arma::uvec x_cols = arma::regspace<arma::uvec>(0, t(0));
+  arma::uvec z_cols = arma::regspace<arma::uvec>(0, t(1));
+  if (n_cov_x_ != 0)
+    x_cols = arma::join_cols(
+        x_cols, arma::regspace<arma::uvec>(P_ + 1, P_ + n_cov_x_));
+  if (n_cov_z_ != 0)
+    z_cols = arma::join_cols(
+        z_cols, arma::regspace<arma::uvec>(D_ + 1, D_ + n_cov_z_));
+
+  return std::make_shared<const JmcmData>(*full_, x_cols, z_cols, t(2) + 1);
+}
+
+inline arma::vec ModelSearch::Pad(const arma::vec& x, const arma::uvec& from,
+                                  const arma::uvec& to) const {
+  arma::uword n_bta = to(0) + 1 + n_cov_x_, n_lmd = to(1) + 1 + n_cov_z_,
+              n_gma = to(2) + 1;
+  arma::vec result = arma::zeros<arma::vec>(n_bta + n_lmd + n_gma);
+
+  // each block of x is [polynomial terms, covariates] and keeps its
+  // coefficients, the new polynomial terms starting at zero
+  arma::uword src = 0, dst = 0;
+  arma::uword n_poly_from[] = {from(0) + 1, from(1) + 1, from(2) + 1};
+  arma::uword n_poly_to[] = {to(0) + 1, to(1) + 1, to(2) + 1};
+  arma::uword n_cov[] = {n_cov_x_, n_cov_z_, 0};
+  for (int b = 0; b != 3; ++b) {
+    result.subvec(dst, dst + n_poly_from[b] - 1) =
+        x.subvec(src, src + n_poly_from[b] - 1);
+    src += n_poly_from[b];
+    dst += n_poly_to[b];
+    if (n_cov[b] != 0)
+      result.subvec(dst, dst + n_cov[b] - 1) =
+          x.subvec(src, src + n_cov[b] - 1);
+    src += n_cov[b];
+    dst += n_cov[b];
+  }
+
+  return result;
+}
+
+inline arma::vec ModelSearch::Start(arma::uword k) const {
+  arma::uvec t = triple(k);
+  arma::uword base = k - k % n_triples_;
+
+  // the fitted neighbour with p, then d, then q one smaller
+  for (arma::uword b = 0; b != 3; ++b) {
+    if (t(b) == 1) continue;
+    arma::uvec from = t;
+    --from(b);
+    arma::uword n = base + triple_id(from(0), from(1), from(2));
+    if (!failed(n)) return Pad(theta_[n], from, t);
+  }
+
+  // (1, 1, 1), or no neighbour fitted: the start of (1, 1, 1)
+  arma::vec gamma = arma::zeros<arma::vec>(2);
+  if (method_id(k) == 2) gamma(0) = arma::datum::pi / 2;
+  arma::uvec one = {1, 1, 1};
+
+  return Pad(arma::join_cols(start_, gamma), one, t);
+}
+
+inline void ModelSearch::Fit(arma::uword k,
+                             std::shared_ptr<const JmcmData> data) {
+  arma::vec x = Start(k);
+
+  // a fit that fails keeps its start, and is marked so that its
+  // neighbours do not start from it
+  try {
+    switch (method_id(k)) {
+      case 0: {
+        JmcmFit<MCD> fit(data, x);
+        x = fit.Optimize();
+        f_min_(k) = fit.get_f_min();
+        n_iters_(k) = fit.get_n_iters();
+        break;
+      }
+      case 1: {
+        JmcmFit<ACD> fit(data, x);
+        x = fit.Optimize();
+        f_min_(k) = fit.get_f_min();
+        n_iters_(k) = fit.get_n_iters();
+        break;
+      }
+      default: {
+        JmcmFit<HPC> fit(data, x);
+        x = fit.Optimize();
+        f_min_(k) = fit.get_f_min();
+        n_iters_(k) = fit.get_n_iters();
+      }
+    }
+    if (!x.is_finite() || !std::isfinite(f_min_(k)))
+      throw std::runtime_error("the fit did not end at a finite point");
+  } catch (const std::exception&) {
+    x = Start(k);
+    f_min_(k) = arma::datum::nan;
+    n_iters_(k) = 0;
+    failed_(k) = 1;
+  }
+
+  theta_[k] = x;
+}
+
+inline void ModelSearch::Run(int n_threads) {
+  arma::uword n_methods = method_ids_.n_elem;
+
+  for (arma::uword level = 3; level <= P_ + D_ + Q_; ++level) {
+    std::vector<arma::uword> ids;  // triples of this level
+    for (arma::uword t = 0; t != n_triples_; ++t)
+      if (arma::accu(triple(t)) == level) ids.push_back(t);
+
+    // the data of a triple are shared by its fits for all the methods
+    std::vector<std::shared_ptr<const JmcmData>> data(ids.size());
+    pan::ChunkPlan triples(ids.size(), 1);
+    pan::ParallelFor(triples.n_chunks(), n_threads, [&](arma::uword c) {
+      data[c] = SubData(triple(ids[c]));
+    });
+
+    pan::ChunkPlan fits(ids.size() * n_methods, 1);
+    pan::ParallelFor(fits.n_chunks(), n_threads, [&](arma::uword c) {
+      arma::uword t = c % ids.size(), j = c / ids.size();
+      Fit(j * n_triples_ + ids[t], data[t]);
+    });
+  }
+}
+
+}  // namespace jmcm
+
+#endif  // JMCM_SRC_MODEL_SEARCH_H_
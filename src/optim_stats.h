@@ -0,0 +1,79 @@
+//  optim_stats.h: telemetry of the optimizers
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_SRC_OPTIM_STATS_H_
+#define JMCM_SRC_OPTIM_STATS_H_
+
+#include <chrono>
+
+namespace pan {
+
+// Why an optimizer stopped: the relative step below tolX, the scaled
+// gradient below grad_tol, the maximum number of iterations, or (for the
+// trust region) a region collapsed without a decrease. kNone for the
+// methods of optim, which do not tell.
+enum class StopReason { kNone, kTolX, kGradTol, kMaxIter, kRadius };
+
+inline const char* StopReasonName(StopReason reason) {
+  switch (reason) {
+    case StopReason::kTolX:
+      return "tolX";
+    case StopReason::kGradTol:
+      return "gradient";
+    case StopReason::kMaxIter:
+      return "maxit";
+    case StopReason::kRadius:
+      return "radius";
+    default:
+      return "none";
+  }
+}
+
+// Wall time (seconds) of the phases of a fit: the updates of beta and of
+// the covariance parameters and the line searches of the profile loop, and
+// the whole fit
+struct PhaseTimes {
+  double beta = 0;
+  double covariance = 0;
+  double line_search = 0;
+  double total = 0;
+
+  void Reset() { beta = covariance = line_search = total = 0; }
+};
+
+// Adds the wall time of its scope to seconds, at the cost of two reads of
+// the clock
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(double& seconds)
+      : seconds_(seconds), start_(std::chrono::steady_clock::now()) {}
+  ScopedTimer(const ScopedTimer&) = delete;
+  ~ScopedTimer() {
+    std::chrono::duration<double> t =
+        std::chrono::steady_clock::now() - start_;
+    seconds_ += t.count();
+  }
+
+ private:
+  double& seconds_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+}  // namespace pan
+
+#endif  // JMCM_SRC_OPTIM_STATS_H_
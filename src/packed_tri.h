@@ -0,0 +1,207 @@
+//  packed_tri.h: lower triangular matrices stored as packed vectors
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_SRC_PACKED_TRI_H_
+#define JMCM_SRC_PACKED_TRI_H_
+
+#define ARMA_DONT_PRINT_ERRORS
+#include <RcppArmadillo.h>
+
+#include <cmath>
+
+namespace pan {
+
+// Non-owning view of an n x n lower triangular matrix L packed by row, the
+// layout of pan::ltrimat / pan::lvectorise with byrow = true:
+//   diag == true   L(0,0), L(1,0), L(1,1), L(2,0), ...   n(n+1)/2 elements
+//   diag == false  L(1,0), L(2,0), L(2,1), ...           n(n-1)/2 elements
+// and a unit diagonal in the second case. The off-diagonal elements are
+// multiplied by scale when read, so that e.g. MCD's T_i = I - Phi_i can be
+// used straight from the packed Phi_i (scale = -1).
+//
+// All the products and solves below run on the packed storage in O(n^2)
+// and may be done in place (y == x).
+class PackedLowerTri {
+ public:
+  PackedLowerTri(const double* x, arma::uword n, bool diag,
+                 double scale = 1.0)
+      : x_(x), n_(n), diag_(diag), scale_(scale) {}
+
+  arma::uword n() const { return n_; }
+  static arma::uword size(arma::uword n, bool diag) {
+    return diag ? n * (n + 1) / 2 : n * (n - 1) / 2;
+  }
+
+  // L(j, k) for k < j, and L(j, j)
+  double lower(arma::uword j, arma::uword k) const {
+    return scale_ * x_[diag_ ? j * (j + 1) / 2 + k : j * (j - 1) / 2 + k];
+  }
+  double diag(arma::uword j) const {
+    return diag_ ? x_[j * (j + 1) / 2 + j] : 1.0;
+  }
+
+  void Multiply(const double* x, double* y) const;       // y = L x
+  void MultiplyTrans(const double* x, double* y) const;  // y = L' x
+  void Solve(const double* x, double* y) const;          // y = L^{-1} x
+  void SolveTrans(const double* x, double* y) const;     // y = L^{-T} x
+
+  arma::vec Multiply(const arma::vec& x) const;
+  arma::vec MultiplyTrans(const arma::vec& x) const;
+  arma::vec Solve(const arma::vec& x) const;
+  arma::vec SolveTrans(const arma::vec& x) const;
+
+  // L^{-1}, packed by row with its diagonal into out (n(n+1)/2 elements)
+  void Invert(double* out) const;
+
+  // sum_j log L(j, j)
+  double LogDet() const;
+
+  // dense copy of L
+  void Unpack(arma::mat& L) const;
+  arma::mat Unpack() const;
+
+  // pack the lower triangle of L by row (strictly lower if diag == false)
+  static void Pack(const arma::mat& L, bool diag, double* out);
+
+ private:
+  const double* x_;
+  arma::uword n_;
+  bool diag_;
+  double scale_;
+
+  // start of row j in the packed storage
+  const double* row(arma::uword j) const {
+    return x_ + (diag_ ? j * (j + 1) / 2 : j * (j - 1) / 2);
+  }
+};
+
+inline void PackedLowerTri::Multiply(const double* x, double* y) const {
+  // from the bottom up, as y_j only needs x_0, ..., x_j
+  for (arma::uword j = n_; j-- > 0;) {
+    const double* Lj = row(j);
+    double s = 0.0;
+    for (arma::uword k = 0; k != j; ++k) s += Lj[k] * x[k];
+    y[j] = scale_ * s + diag(j) * x[j];
+  }
+}
+
+inline void PackedLowerTri::MultiplyTrans(const double* x, double* y) const {
+  // from the top down, as y_k only needs x_k, ..., x_{n-1}
+  for (arma::uword k = 0; k != n_; ++k) {
+    double s = 0.0;
+    for (arma::uword j = k + 1; j < n_; ++j) s += row(j)[k] * x[j];
+    y[k] = scale_ * s + diag(k) * x[k];
+  }
+}
+
+inline void PackedLowerTri::Solve(const double* x, double* y) const {
+  for (arma::uword j = 0; j != n_; ++j) {
+    const double* Lj = row(j);
+    double s = 0.0;
+    for (arma::uword k = 0; k != j; ++k) s += Lj[k] * y[k];
+    y[j] = (x[j] - scale_ * s) / diag(j);
+  }
+}
+
+inline void PackedLowerTri::SolveTrans(const double* x, double* y) const {
+  // column-oriented back substitution, reading L by rows
+  if (y != x)
+    for (arma::uword k = 0; k != n_; ++k) y[k] = x[k];
+  for (arma::uword j = n_; j-- > 0;) {
+    y[j] /= diag(j);
+    const double* Lj = row(j);
+    double yj = scale_ * y[j];
+    for (arma::uword k = 0; k != j; ++k) y[k] -= Lj[k] * yj;
+  }
+}
+
+inline arma::vec PackedLowerTri::Multiply(const arma::vec& x) const {
+  arma::vec y(n_);
+  Multiply(x.memptr(), y.memptr());
+  return y;
+}
+
+inline arma::vec PackedLowerTri::MultiplyTrans(const arma::vec& x) const {
+  arma::vec y(n_);
+  MultiplyTrans(x.memptr(), y.memptr());
+  return y;
+}
+
+inline arma::vec PackedLowerTri::Solve(const arma::vec& x) const {
+  arma::vec y(n_);
+  Solve(x.memptr(), y.memptr());
+  return y;
+}
+
+inline arma::vec PackedLowerTri::SolveTrans(const arma::vec& x) const {
+  arma::vec y(n_);
+  SolveTrans(x.memptr(), y.memptr());
+  return y;
+}
+
+inline void PackedLowerTri::Invert(double* out) const {
+  // row j of X = L^{-1}: X(j, j) = 1 / L(j, j) and, for k < j,
+  // X(j, k) = -sum_{l = k}^{j - 1} L(j, l) X(l, k) / L(j, j)
+  for (arma::uword j = 0; j != n_; ++j) {
+    const double* Lj = row(j);
+    double* Xj = out + j * (j + 1) / 2;
+    double djj = diag(j);
+    for (arma::uword k = 0; k != j; ++k) {
+      double s = 0.0;
+      for (arma::uword l = k; l != j; ++l)
+        s += Lj[l] * out[l * (l + 1) / 2 + k];
+      Xj[k] = -scale_ * s / djj;
+    }
+    Xj[j] = 1.0 / djj;
+  }
+}
+
+inline double PackedLowerTri::LogDet() const {
+  double result = 0.0;
+  if (diag_)
+    for (arma::uword j = 0; j != n_; ++j) result += std::log(diag(j));
+
+  return result;
+}
+
+inline void PackedLowerTri::Unpack(arma::mat& L) const {
+  L.zeros(n_, n_);
+  for (arma::uword j = 0; j != n_; ++j) {
+    const double* Lj = row(j);
+    for (arma::uword k = 0; k != j; ++k) L(j, k) = scale_ * Lj[k];
+    L(j, j) = diag(j);
+  }
+}
+
+inline arma::mat PackedLowerTri::Unpack() const {
+  arma::mat L;
+  Unpack(L);
+  return L;
+}
+
+inline void PackedLowerTri::Pack(const arma::mat& L, bool diag, double* out) {
+  arma::uword n = L.n_rows;
+  for (arma::uword j = 0; j != n; ++j) {
+    arma::uword len = diag ? j + 1 : j;
+    for (arma::uword k = 0; k != len; ++k) *out++ = L(j, k);
+  }
+}
+
+}  // namespace pan
+
+#endif  // JMCM_SRC_PACKED_TRI_H_
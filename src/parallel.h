@@ -0,0 +1,222 @@
+//  parallel.h: subject-parallel loops with a deterministic reduction
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_SRC_PARALLEL_H_
+#define JMCM_SRC_PARALLEL_H_
+
+#define ARMA_DONT_PRINT_ERRORS
+#include <RcppArmadillo.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+namespace pan {
+
+// The n items of a loop (subjects or covariance patterns) are cut into
+// chunks of consecutive items. The chunks do not depend on the number of
+// threads: every chunk accumulates its own partial result serially and the
+// partial results are added up by TreeSum in a fixed order, so that the
+// sums are bit-identical for any number of threads.
+//
+// The cost of a subject grows like m_i^2 to m_i^3, so with very different
+// m_i chunks of equally many subjects take very different times. Given the
+// costs of the items, the chunks are instead cut to about equal total cost
+// and run from the most to the least costly: with the chunks handed out
+// one at a time to the threads that are free (schedule(dynamic, 1)), this
+// is the longest-processing-time-first list schedule, and the last chunks
+// to start are the cheapest ones.
+class ChunkPlan {
+ public:
+  static const arma::uword kChunkSize = 32;
+
+  // chunks of chunk_size items, run in order
+  explicit ChunkPlan(arma::uword n = 0, arma::uword chunk_size = kChunkSize);
+
+  // as many chunks as chunks of kChunkSize items would be, of about equal
+  // cost (an item costing more being a chunk on its own)
+  explicit ChunkPlan(const arma::vec& cost);
+
+  arma::uword n_chunks() const { return cost_.n_elem; }
+  arma::uword begin(arma::uword c) const { return offset_(c); }
+  arma::uword end(arma::uword c) const { return offset_(c + 1); }
+  double cost(arma::uword c) const { return cost_(c); }
+
+  // the chunk started r-th
+  arma::uword order(arma::uword r) const { return order_(r); }
+
+ private:
+  arma::uvec offset_;  // n_chunks + 1 entries into the items
+  arma::uvec order_;
+  arma::vec cost_;
+};
+
+inline ChunkPlan::ChunkPlan(arma::uword n, arma::uword chunk_size) {
+  arma::uword n_chunks = (n + chunk_size - 1) / chunk_size;
+  offset_.set_size(n_chunks + 1);
+  order_.set_size(n_chunks);
+  cost_.set_size(n_chunks);
+  for (arma::uword c = 0; c != n_chunks; ++c) {
+    offset_(c) = c * chunk_size;
+    order_(c) = c;
+    cost_(c) = std::min(n, (c + 1) * chunk_size) - offset_(c);
+  }
+  offset_(n_chunks) = n;
+}
+
+inline ChunkPlan::ChunkPlan(const arma::vec& cost) {
+  arma::uword n = cost.n_elem;
+  arma::uword n_target =
+      std::max<arma::uword>(1, (n + kChunkSize - 1) / kChunkSize);
+  double target = arma::accu(cost) / n_target;
+
+  std::vector<arma::uword> offset(1, 0);
+  std::vector<double> chunk_cost;
+  double sum = 0.0;
+  for (arma::uword i = 0; i != n; ++i) {
+    if (i != offset.back() && sum + cost(i) > target) {
+      offset.push_back(i);
+      chunk_cost.push_back(sum);
+      sum = 0.0;
+    }
+    sum += cost(i);
+  }
+  if (n != 0) {
+    offset.push_back(n);
+    chunk_cost.push_back(sum);
+  }
+
+  offset_ = arma::conv_to<arma::uvec>::from(offset);
+  cost_ = arma::conv_to<arma::vec>::from(chunk_cost);
+  order_ = arma::stable_sort_index(cost_, "descend");
+}
+
+// Time the threads spend in the chunks of the loops. For every loop the
+// longest busy time of a thread, which is the time the loop takes, and the
+// mean over the threads are added up; max_busy / mean_busy - 1 is then the
+// share of the loops' time that is lost to threads waiting for the others.
+struct LoadStats {
+  double n_loops = 0;
+  double max_busy = 0;   // seconds
+  double mean_busy = 0;  // seconds
+
+  void Reset() { n_loops = max_busy = mean_busy = 0; }
+  double imbalance() const {
+    return mean_busy > 0 ? max_busy / mean_busy - 1 : 0;
+  }
+};
+
+// number of threads available to the loops below
+inline int MaxThreads() {
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+// number of the calling thread within its team
+inline int ThreadNum() {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+// f(c) for c = 0, ..., n_chunks - 1 on up to n_threads threads. f must only
+// write to storage owned by chunk c and must not call back into R.
+template <typename F>
+void ParallelFor(arma::uword n_chunks, int n_threads, const F& f) {
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1) num_threads(n_threads) \
+    if (n_threads > 1 && n_chunks > 1)
+#endif
+  for (arma::uword c = 0; c < n_chunks; ++c) f(c);
+}
+
+// The threads a loop runs on, and where their busy times are added up (if
+// anywhere). A number of threads converts to a team without statistics.
+struct ThreadTeam {
+  ThreadTeam(int n_threads, LoadStats* stats = nullptr)  // NOLINT
+      : n_threads(n_threads), stats(stats) {}
+
+  int n_threads;
+  LoadStats* stats;
+};
+
+// f(c) for the chunks c of chunks, in the order of the plan
+template <typename F>
+void ParallelFor(const ChunkPlan& chunks, ThreadTeam team, const F& f) {
+  arma::uword n_chunks = chunks.n_chunks();
+  if (team.stats == nullptr) {
+    ParallelFor(n_chunks, team.n_threads,
+                [&](arma::uword r) { f(chunks.order(r)); });
+    return;
+  }
+
+  std::vector<double> busy(std::max(team.n_threads, 1), 0.0);
+  ParallelFor(n_chunks, team.n_threads, [&](arma::uword r) {
+    auto start = std::chrono::steady_clock::now();
+    f(chunks.order(r));
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+    busy[ThreadNum()] += t.count();
+  });
+
+  double max_busy = 0.0, sum_busy = 0.0;
+  for (double b : busy) {
+    max_busy = std::max(max_busy, b);
+    sum_busy += b;
+  }
+  team.stats->n_loops += 1;
+  team.stats->max_busy += max_busy;
+  team.stats->mean_busy += sum_busy / busy.size();
+}
+
+// parts[0] + ... + parts[n - 1] as a pairwise tree of fixed shape; parts
+// is overwritten
+template <typename T>
+T TreeSum(std::vector<T>& parts, const T& zero) {
+  std::size_t n = parts.size();
+  if (n == 0) return zero;
+
+  for (std::size_t step = 1; step < n; step *= 2)
+    for (std::size_t i = 0; i + step < n; i += 2 * step)
+      parts[i] += parts[i + step];
+
+  return parts[0];
+}
+
+// sum over the chunks of the partial results f(c, part), each part starting
+// from zero
+template <typename T, typename F>
+T ParallelSum(const ChunkPlan& chunks, ThreadTeam team, const T& zero,
+              const F& f) {
+  std::vector<T> parts(chunks.n_chunks(), zero);
+  ParallelFor(chunks, team, [&](arma::uword c) { f(c, parts[c]); });
+
+  return TreeSum(parts, zero);
+}
+
+}  // namespace pan
+
+#endif  // JMCM_SRC_PARALLEL_H_
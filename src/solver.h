@@ -0,0 +1,95 @@
+//  solver.h: structured linear solves for the joint mean-covariance models
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_SRC_SOLVER_H_
+#define JMCM_SRC_SOLVER_H_
+
+#define ARMA_DONT_PRINT_ERRORS
+#include <RcppArmadillo.h>
+
+#include <cmath>
+
+#include "packed_tri.h"
+
+namespace pan {
+
+// Number of systems solved by each method. The SVD is only used when the
+// structured factorization breaks down, so a nonzero n_svd means that the
+// problem was (numerically) singular somewhere and the fit should be
+// looked at.
+struct SolverStats {
+  double n_chol = 0;  // Cholesky factorizations of normal equations
+  double n_tri = 0;   // triangular inversions
+  double n_svd = 0;   // SVD (pseudo-inverse) fallbacks
+
+  void Reset() { n_chol = n_tri = n_svd = 0; }
+
+  SolverStats& operator+=(const SolverStats& other) {
+    n_chol += other.n_chol;
+    n_tri += other.n_tri;
+    n_svd += other.n_svd;
+    return *this;
+  }
+};
+
+// x = A^{-1} b for a symmetric positive definite A, such as the X' S X and
+// G' D G of the normal equations, by A = R'R and two triangular solves.
+// If A is not numerically positive definite x = pinv(A) b. Returns false
+// in that case.
+inline bool SolveSympd(const arma::mat& A, const arma::vec& b, arma::vec& x,
+                       SolverStats* stats = nullptr) {
+  arma::mat R;
+  if (arma::chol(R, A)) {
+    arma::vec z = arma::solve(arma::trimatl(R.t()), b);
+    x = arma::solve(arma::trimatu(R), z);
+    if (stats != nullptr) ++stats->n_chol;
+    return true;
+  }
+
+  x = arma::pinv(A) * b;
+  if (stats != nullptr) ++stats->n_svd;
+  return false;
+}
+
+// L^{-1} for a packed lower triangular L, packed by row with its diagonal
+// into out. The substitution of PackedLowerTri::Invert is used unless a
+// diagonal element of L is zero or not finite, in which case the
+// pseudo-inverse of L is packed instead. Returns false in that case.
+inline bool InvertLowerTri(const PackedLowerTri& L, double* out,
+                           SolverStats* stats = nullptr) {
+  bool is_regular = true;
+  for (arma::uword j = 0; j != L.n(); ++j) {
+    double d = L.diag(j);
+    if (!(std::abs(d) > 0) || !std::isfinite(d)) is_regular = false;
+  }
+
+  if (is_regular) {
+    L.Invert(out);
+    if (stats != nullptr) ++stats->n_tri;
+    return true;
+  }
+
+  arma::mat L_inv = arma::pinv(L.Unpack());
+  PackedLowerTri::Pack(L_inv, true, out);
+  if (stats != nullptr) ++stats->n_svd;
+  return false;
+}
+
+}  // namespace pan
+
+#endif  // JMCM_SRC_SOLVER_H_
@@ -0,0 +1,204 @@
+//  start_values.h: start values of the joint mean-covariance models
+//                  (MCD/ACD/HPC)
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_SRC_START_VALUES_H_
+#define JMCM_SRC_START_VALUES_H_
+
+#define ARMA_DONT_PRINT_ERRORS
+#include <RcppArmadillo.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "jmcm_base.h"
+#include "solver.h"
+
+namespace jmcm {
+
+// Both strategies start beta at the least squares fit, i.e. the fit under
+// Sigma_i = I. They differ in (lambda, gamma):
+//   OlsStart    regresses log r_ij^2 on Z and takes gamma = 0 (the first
+//               angle pi / 2 for HPC, so that Sigma_i is diagonal)
+//   MomentStart regresses the log (innovation) variances and the lower
+//               triangular parameters of the covariance of the residuals,
+//               binned by visit, on Z and W, i.e. fits the sample
+//               regressogram (see regressogram() in R)
+
+inline arma::vec OlsBeta(const JmcmData& data) {
+  arma::vec beta;
+  pan::SolveSympd(data.X.t() * data.X, data.X.t() * data.Y, beta);
+
+  return beta;
+}
+
+inline arma::vec DefaultGamma(const JmcmData& data, arma::uword method_id) {
+  arma::vec gamma = arma::zeros<arma::vec>(data.lags.n_cols());
+  if (method_id == 2) gamma(0) = arma::datum::pi / 2;
+
+  return gamma;
+}
+
+inline arma::vec OlsStart(const JmcmData& data, arma::uword method_id) {
+  arma::vec beta = OlsBeta(data);
+  arma::vec r = data.Y - data.X * beta;
+
+  // a residual that is exactly zero (a tie, or an observation fitted
+  // exactly) has log r^2 = -Inf, so the squares are floored at a small
+  // fraction of their mean, or at one if all of them are zero
+  arma::vec r2 = r % r;
+  double r2_min = std::sqrt(std::numeric_limits<double>::epsilon()) *
+                  arma::mean(r2);
+  if (!(r2_min > 0)) r2_min = 1.0;
+  r2 = arma::clamp(r2, r2_min, arma::datum::inf);
+
+  arma::vec lambda;
+  pan::SolveSympd(data.Z.t() * data.Z, data.Z.t() * arma::log(r2), lambda);
+
+  return arma::join_cols(arma::join_cols(beta, lambda),
+                         DefaultGamma(data, method_id));
+}
+
+// Covariance of the residuals r binned by visit: S(j, k) is the mean of
+// r_ij r_ik over the subjects with more than max(j, k) visits, for the
+// visits that at least two subjects reach. For balanced data it is the
+// sample covariance about the fitted mean.
+inline arma::mat BinnedCovariance(const SubjectIndex& index,
+                                  const arma::vec& r) {
+  arma::uword n_sub = index.n_sub(), max_m = 0;
+  for (arma::uword i = 0; i != n_sub; ++i) max_m = std::max(max_m, index.m(i));
+
+  arma::uvec reach = arma::zeros<arma::uvec>(max_m);
+  for (arma::uword i = 0; i != n_sub; ++i)
+    for (arma::uword j = 0; j != index.m(i); ++j) ++reach(j);
+  arma::uword n_bins = 0;
+  while (n_bins != max_m && reach(n_bins) >= 2) ++n_bins;
+
+  arma::mat S = arma::zeros<arma::mat>(n_bins, n_bins);
+  for (arma::uword i = 0; i != n_sub; ++i) {
+    arma::uword mi = std::min(index.m(i), n_bins);
+    const double* ri = r.memptr() + index.obs_begin(i);
+    for (arma::uword j = 0; j != mi; ++j)
+      for (arma::uword k = 0; k <= j; ++k) S(j, k) += ri[j] * ri[k];
+  }
+
+  // the number of subjects with visits j and k is reach(max(j, k))
+  for (arma::uword j = 0; j != n_bins; ++j)
+    for (arma::uword k = 0; k <= j; ++k) S(k, j) = S(j, k) /= reach(j);
+
+  return S;
+}
+
+// The decomposition of S done by regressogram(): the log (innovation)
+// variances, and in the strictly lower triangle of phi the autoregressive
+// (MCD) or moving average (ACD) coefficients or the angles (HPC). Returns
+// false if S is not positive definite.
+inline bool Regressogram(const arma::mat& S, arma::uword method_id,
+                         arma::vec& log_var, arma::mat& phi) {
+  arma::mat C;
+  if (S.n_rows == 0 || !arma::chol(C, S, "lower")) return false;
+  arma::vec d = C.diag();
+
+  switch (method_id) {
+    case 0: {
+      // T S T' = D with T = (C diag(1 / d))^{-1}
+      arma::mat L = C.each_row() / d.t();
+      phi = -arma::inv(arma::trimatl(L));
+      log_var = 2 * arma::log(d);
+      break;
+    }
+    case 1: {
+      // S = D^{1/2} T T' D^{1/2} with T = diag(1 / d) C
+      phi = C.each_col() / d;
+      log_var = 2 * arma::log(d);
+      break;
+    }
+    default: {
+      // the Cholesky factor B = diag(1 / sd) C of the correlation matrix
+      // has B_jk = cos(phi_jk) sin(phi_j1) ... sin(phi_j,k-1)
+      arma::vec sd = arma::sqrt(S.diag());
+      arma::mat B = C.each_col() / sd;
+      phi = arma::zeros<arma::mat>(S.n_rows, S.n_cols);
+      for (arma::uword j = 1; j != S.n_rows; ++j) {
+        double prod = 1.0;
+        for (arma::uword k = 0; k != j; ++k) {
+          double c = prod > 0 ? B(j, k) / prod : 0.0;
+          phi(j, k) = std::acos(std::max(-1.0, std::min(1.0, c)));
+          prod *= std::sin(phi(j, k));
+        }
+      }
+      log_var = 2 * arma::log(sd);
+    }
+  }
+
+  return log_var.is_finite() && phi.is_finite();
+}
+
+inline arma::vec MomentStart(const JmcmData& data, arma::uword method_id) {
+  const SubjectIndex& index = data.index;
+  const LagTable& lags = data.lags;
+
+  arma::vec beta = OlsBeta(data);
+  arma::vec r = data.Y - data.X * beta;
+
+  arma::mat S = BinnedCovariance(index, r);
+  arma::vec log_var;
+  arma::mat phi;
+  if (!Regressogram(S, method_id, log_var, phi))
+    return OlsStart(data, method_id);
+  arma::uword n_bins = S.n_rows;
+
+  // lambda by least squares of log_var(j) on the rows of Z of the visits
+  // j < n_bins, gamma of phi(j, k) on the rows of W of those pairs, the
+  // latter summed per distinct lag
+  arma::uvec obs(index.n_obs());
+  arma::vec target(index.n_obs());
+  arma::uword n_obs = 0;
+  arma::vec n_per_lag = arma::zeros<arma::vec>(lags.n_lag());
+  arma::vec phi_per_lag = arma::zeros<arma::vec>(lags.n_lag());
+  for (arma::uword i = 0; i != index.n_sub(); ++i) {
+    arma::uword mi = std::min(index.m(i), n_bins);
+    for (arma::uword j = 0; j != mi; ++j) {
+      obs(n_obs) = index.obs_begin(i) + j;
+      target(n_obs++) = log_var(j);
+      for (arma::uword k = 0; k != j; ++k) {
+        arma::uword l = lags.lag_id(index.pair_index(i, j, k));
+        ++n_per_lag(l);
+        phi_per_lag(l) += phi(j, k);
+      }
+    }
+  }
+
+  arma::mat Z = data.Z.rows(obs.head(n_obs));
+  arma::vec lambda;
+  pan::SolveSympd(Z.t() * Z, Z.t() * target.head(n_obs), lambda);
+
+  arma::vec gamma = DefaultGamma(data, method_id);
+  if (arma::accu(n_per_lag) > 0) {
+    const arma::mat& table = lags.table();
+    arma::mat WtW = table.t() * (table.each_col() % n_per_lag);
+    pan::SolveSympd(WtW, lags.MultiplyTrans(phi_per_lag), gamma);
+  }
+
+  return arma::join_cols(arma::join_cols(beta, lambda), gamma);
+}
+
+}  // namespace jmcm
+
+#endif  // JMCM_SRC_START_VALUES_H_
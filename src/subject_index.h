@@ -0,0 +1,87 @@
+//  subject_index.h: offsets of the per-subject blocks in the stacked data of
+//                   the joint mean-covariance models (MCD/ACD/HPC)
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_SRC_SUBJECT_INDEX_H_
+#define JMCM_SRC_SUBJECT_INDEX_H_
+
+#define ARMA_DONT_PRINT_ERRORS
+#include <RcppArmadillo.h>
+
+namespace jmcm {
+
+// The data of all subjects are stacked in three different layouts:
+//   obs  -- Y, X, Z, Xbta, Zlmd, Resid, ...     m_i rows per subject
+//   pair -- W, Wgma (strictly lower part of T_i) m_i * (m_i - 1) / 2 rows
+//   tri  -- Telem, invTelem (lower part of T_i)  m_i * (m_i + 1) / 2 rows
+// SubjectIndex computes the start row of every subject in each layout once,
+// so that all the per-subject accessors are O(1) instead of a prefix sum.
+class SubjectIndex {
+ public:
+  SubjectIndex() = default;
+  explicit SubjectIndex(const arma::vec& m);
+
+  arma::uword n_sub() const { return m_.n_elem; }
+  arma::uword n_obs() const { return obs_offset_(m_.n_elem); }
+  arma::uword n_pairs() const { return pair_offset_(m_.n_elem); }
+  arma::uword n_tri() const { return tri_offset_(m_.n_elem); }
+
+  arma::uword m(arma::uword i) const { return m_(i); }
+  arma::uword n_pairs(arma::uword i) const {
+    return pair_offset_(i + 1) - pair_offset_(i);
+  }
+  arma::uword n_tri(arma::uword i) const {
+    return tri_offset_(i + 1) - tri_offset_(i);
+  }
+
+  arma::uword obs_begin(arma::uword i) const { return obs_offset_(i); }
+  arma::uword pair_begin(arma::uword i) const { return pair_offset_(i); }
+  arma::uword tri_begin(arma::uword i) const { return tri_offset_(i); }
+
+  // row of W (or Wgma) for the pair (j, k), j > k, of subject i
+  arma::uword pair_index(arma::uword i, arma::uword j, arma::uword k) const {
+    return pair_offset_(i) + j * (j - 1) / 2 + k;
+  }
+
+ private:
+  arma::uvec m_;
+
+  // n_sub + 1 entries each, the last one being the total length
+  arma::uvec obs_offset_, pair_offset_, tri_offset_;
+};
+
+inline SubjectIndex::SubjectIndex(const arma::vec& m)
+    : m_(arma::conv_to<arma::uvec>::from(m)),
+      obs_offset_(m.n_elem + 1),
+      pair_offset_(m.n_elem + 1),
+      tri_offset_(m.n_elem + 1) {
+  obs_offset_(0) = 0;
+  pair_offset_(0) = 0;
+  tri_offset_(0) = 0;
+
+  for (arma::uword i = 0; i != m_.n_elem; ++i) {
+    arma::uword mi = m_(i);
+    obs_offset_(i + 1) = obs_offset_(i) + mi;
+    pair_offset_(i + 1) = pair_offset_(i) + mi * (mi - 1) / 2;
+    tri_offset_(i + 1) = tri_offset_(i) + mi * (mi + 1) / 2;
+  }
+}
+
+}  // namespace jmcm
+
+#endif  // JMCM_SRC_SUBJECT_INDEX_H_
@@ -0,0 +1,79 @@
+//  trust_region.h: trust-region Newton method for ill-conditioned fits
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+#ifndef JMCM_TRUST_REGION_H_
+#define JMCM_TRUST_REGION_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+
+#include <RcppArmadillo.h>
+
+#include "optim_stats.h"
+
+namespace pan {
+
+// Newton's method with a trust region in place of a line search: every
+// iteration minimizes the quadratic model g'p + p'Bp / 2 over |p| <= delta
+// by the truncated conjugate gradients of Steihaug, which stop at the
+// boundary on negative curvature, and accepts the step if -2l decreases by
+// a fraction of the decrease of the model. A value that is not finite only
+// shrinks the region. B is the Hessian of func (exact) or its BFGS
+// approximation, started at a unit matrix. T must provide ValueAndGradient
+// and Hessian (see JmcmBase).
+template <typename T>
+class TrustRegion {
+ public:
+  TrustRegion();
+  ~TrustRegion();
+
+  void set_trace(bool trace) { trace_ = trace; }
+  void set_message(bool message) { message_ = message; }
+  void set_exact_hessian(bool exact) { exact_ = exact; }
+  void Optimize(T& func, arma::vec& x, const double grad_tol = 1e-6);
+  int n_iters() const;
+  double f_min() const;
+  StopReason stop_reason() const { return stop_reason_; }
+  // trial steps rejected (and the region shrunk) by the fits so far, the
+  // counterpart of the backtracks of a line search
+  double n_rejected() const { return n_rejected_; }
+
+ private:
+  bool trace_;
+  bool message_;
+  bool exact_;
+  int n_iters_;
+  double f_min_;
+  StopReason stop_reason_;
+  double n_rejected_;
+
+  // approximate minimizer of g'p + p'Bp / 2 over |p| <= delta
+  static arma::vec Steihaug(const arma::vec& grad, const arma::mat& B,
+                            double delta);
+  // z + tau d with tau >= 0 on the boundary |p| = delta, for |z| < delta
+  static arma::vec ToBoundary(const arma::vec& z, const arma::vec& d,
+                              double delta);
+};  // class TrustRegion
+
+#include "trust_region_impl.h"
+
+}  // namespace pan
+
+#endif  // JMCM_TRUST_REGION_H_
@@ -0,0 +1,213 @@
+//  trust_region_impl.h: trust-region Newton method for ill-conditioned fits
+//  This file is part of jmcm.
+//
+//  Copyright (C) 2015-2018 Yi Pan <ypan1988@gmail.com>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 2 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  A copy of the GNU General Public License is available at
+//  https://www.R-project.org/Licenses/
+
+/**
+ * Constructor
+ */
+template <typename T>
+TrustRegion<T>::TrustRegion()
+    : trace_(false),
+      message_(false),
+      exact_(true),
+      n_iters_(0),
+      f_min_(0),
+      stop_reason_(StopReason::kNone),
+      n_rejected_(0) {}
+
+/**
+ * Destructor
+ */
+template <typename T>
+TrustRegion<T>::~TrustRegion() {}
+
+/**
+ * Implement the trust-region Newton method
+ *
+ * @param func Instance of function to be optimized
+ * @param x Parameters
+ * @param grad_tol The convergence requirement on zeroing the gradient
+ */
+template <typename T>
+void TrustRegion<T>::Optimize(T &func, arma::vec &x, const double grad_tol) {
+  // Maximum number of iterations
+  const int kIterMax = 200;
+
+  // Machine precision
+  const double kEpsilon = std::numeric_limits<double>::epsilon();
+
+  // Convergence criterion on x values
+  const double kTolX = 4 * kEpsilon;
+
+  // Scaled maximum radius of the trust region
+  const double kScaStepMax = 100;
+
+  // Smallest ratio of actual to predicted decrease of an accepted step
+  const double kEta = 1e-4;
+
+  const int n_pars = x.n_rows;  // number of parameters
+
+  // Calculate starting function value, gradient and model Hessian
+  double f;
+  arma::vec grad;
+  arma::mat B;
+  func.ValueAndGradient(x, f, grad);
+  if (exact_)
+    func.Hessian(x, B);
+  else
+    B = arma::eye<arma::mat>(n_pars, n_pars);
+  f_min_ = f;
+
+  // Calculate the maximum radius
+  double sum = sqrt(arma::dot(x, x));
+  const double kDeltaMax = kScaStepMax * std::max(sum, double(n_pars));
+  double delta = std::min(1.0, kDeltaMax);
+
+  // Main loop over the iterations
+  for (int iter = 0; iter != kIterMax; ++iter) {
+    n_iters_ = iter;
+
+    // Test for convergence on zero gradient
+    double test = 0.0;
+    double den = std::max(f, 1.0);
+    for (int i = 0; i != n_pars; ++i) {
+      double temp = std::abs(grad(i)) * std::max(std::abs(x(i)), 1.0) / den;
+      if (temp > test) test = temp;
+    }
+    if (test < grad_tol) {
+      stop_reason_ = StopReason::kGradTol;
+      return;
+    }
+
+    arma::vec p = Steihaug(grad, B, delta);
+    double p_norm = arma::norm(p);
+    double pred = -(arma::dot(grad, p) + 0.5 * arma::dot(p, B * p));
+
+    arma::vec xnew = x + p;
+    double fnew = func(xnew);
+    double rho = (std::isfinite(fnew) && pred > 0) ? (f - fnew) / pred : -1;
+
+    // Update the radius
+    if (rho < 0.25)
+      delta = 0.25 * p_norm;
+    else if (rho > 0.75 && p_norm >= 0.99 * delta)
+      delta = std::min(2 * delta, kDeltaMax);
+
+    if (rho > kEta) {
+      arma::vec grad2 = grad;     // Save the old gradient
+      func.Gradient(xnew, grad);  // Get the new gradient
+      x = xnew;
+      f = fnew;
+      f_min_ = f;
+
+      if (trace_) {
+        Rcpp::Rcout << std::setw(5) << iter << ": " << std::setw(10) << f
+                    << ": ";
+        x.t().print();
+      }
+
+      // Test for convergence on Delta x
+      test = 0.0;
+      for (int i = 0; i != n_pars; ++i) {
+        double temp = std::abs(p(i)) / std::max(std::abs(x(i)), 1.0);
+        if (temp > test) test = temp;
+      }
+      if (test < kTolX) {
+        stop_reason_ = StopReason::kTolX;
+        return;
+      }
+
+      if (exact_) {
+        func.Hessian(x, B);
+      } else {
+        // BFGS update of B itself, skipped if y's is not sufficiently
+        // positive
+        arma::vec dg = grad - grad2;
+        double fac = arma::dot(dg, p);
+        arma::vec Bp = B * p;
+        if (fac > sqrt(kEpsilon * arma::dot(dg, dg) * arma::dot(p, p)))
+          B += dg * dg.t() / fac - Bp * Bp.t() / arma::dot(p, Bp);
+      }
+      continue;
+    }
+
+    ++n_rejected_;
+    if (delta < kTolX * std::max(arma::norm(x), 1.0)) {
+      // The region has collapsed without a decrease
+      stop_reason_ = StopReason::kRadius;
+      if (message_)
+        Rcpp::Rcerr << "trust region too small in trust" << std::endl;
+      return;
+    }
+  }
+  stop_reason_ = StopReason::kMaxIter;
+  if (message_) {
+    Rcpp::Rcerr << "too many iterations in trust" << std::endl;
+  }
+}
+
+template <typename T>
+arma::vec TrustRegion<T>::Steihaug(const arma::vec &grad, const arma::mat &B,
+                                   double delta) {
+  arma::vec z = arma::zeros<arma::vec>(grad.n_elem);
+  arma::vec r = grad, d = -grad;
+
+  // Stop at the relative residual min(0.5, sqrt|g|), for superlinear
+  // convergence near the minimum
+  double g_norm = arma::norm(grad);
+  double tol = std::min(0.5, std::sqrt(g_norm)) * g_norm;
+  if (g_norm == 0) return z;
+
+  for (arma::uword j = 0; j != grad.n_elem; ++j) {
+    arma::vec Bd = B * d;
+    double dBd = arma::dot(d, Bd);
+    if (dBd <= 0) return ToBoundary(z, d, delta);  // negative curvature
+
+    double rr = arma::dot(r, r);
+    double alpha = rr / dBd;
+    arma::vec z1 = z + alpha * d;
+    if (arma::norm(z1) >= delta) return ToBoundary(z, d, delta);
+
+    r += alpha * Bd;
+    z = z1;
+    if (arma::norm(r) < tol) return z;
+
+    d = -r + (arma::dot(r, r) / rr) * d;
+  }
+
+  return z;
+}
+
+template <typename T>
+arma::vec TrustRegion<T>::ToBoundary(const arma::vec &z, const arma::vec &d,
+                                     double delta) {
+  double a = arma::dot(d, d), b = 2 * arma::dot(z, d),
+         c = arma::dot(z, z) - delta * delta;
+  double tau = (-b + std::sqrt(b * b - 4 * a * c)) / (2 * a);
+
+  return z + tau * d;
+}
+
+template <typename T>
+int TrustRegion<T>::n_iters() const {
+  return n_iters_;
+}
+
+template <typename T>
+double TrustRegion<T>::f_min() const {
+  return f_min_;
+}